@@ -74,6 +74,10 @@ let _ = Callback.register "getLastError" getLastError
 let _ = Callback.register "getLastErrorString" getLastErrorString
 let _ = Callback.register "clearError" clearError
 
+(* The references themselves, read directly by the C wrapper after each call. *)
+let _ = Callback.register "lastError" lastError
+let _ = Callback.register "lastErrorString" lastErrorString
+
 (* Dummy return values for each possible return type *)
 let err_int = 0
 let err_float = 0.
@@ -126,6 +130,14 @@ let _ = Callback.register "inOfPt" inOfPt
 
 type range = int
 
+(* Scopes. A scope records the PDFs and ranges made while it is the innermost
+one, so that they can all be deleted when it ends. *)
+type scope =
+  {mutable scope_pdfs : int list;
+   mutable scope_ranges : int list}
+
+let scopes = ref []
+
 let ranges = null_hash ()
 
 let rangekey = ref 0
@@ -133,16 +145,42 @@ let rangekey = ref 0
 let new_range arr =
   incr rangekey;
   Hashtbl.add ranges !rangekey arr;
+  begin match !scopes with
+  | s::_ -> s.scope_ranges <- !rangekey :: s.scope_ranges
+  | [] -> ()
+  end;
   !rangekey
 
 let lookup_range i =
   Hashtbl.find ranges i
 
+(* The members of a range, as a table, so that membership is found in
+constant time. Made on first use, and kept until the range is written to or
+deleted. *)
+let range_members = null_hash ()
+
+let members_of_array arr =
+  let h = Hashtbl.create (Array.length arr) in
+    Array.iter (fun x -> Hashtbl.replace h x ()) arr;
+    h
+
+let lookup_members i =
+  match Hashtbl.find range_members i with
+  | h -> h
+  | exception Not_found ->
+      let h = members_of_array (lookup_range i) in
+        Hashtbl.add range_members i h;
+        h
+
 let blankrange () =
   try new_range (Array.make 0 0) with e -> handle_error "blankrange" e; err_int
 
 let writerange r p n =
-  try Array.set (lookup_range r) p n with e -> handle_error "writerange" e; err_unit
+  try
+    Hashtbl.remove range_members r;
+    Array.set (lookup_range r) p n
+  with
+    e -> handle_error "writerange" e; err_unit
 
 let makerange len =
   try new_range (Array.make len 0) with e -> handle_error "makerange" e; err_int
@@ -164,13 +202,27 @@ let addtorange r p =
   with
     e -> handle_error "addtorange" e; err_int
 
+(* A range from an array of pages made by the C side, which is not used
+elsewhere, so needs no copy. *)
+let rangeFromArray arr =
+  try new_range arr with e -> handle_error "rangeFromArray" e; err_int
+
+let rangeToArray r =
+  try lookup_range r with e -> handle_error "rangeToArray" e; [||]
+
 let deleterange r =
-  try Hashtbl.remove ranges r with e -> handle_error "deleterange" e; err_unit
+  try
+    Hashtbl.remove range_members r;
+    Hashtbl.remove ranges r
+  with
+    e -> handle_error "deleterange" e; err_unit
 
 let _ = Callback.register "blankRange" blankrange
 let _ = Callback.register "rangeLength" lengthrange
 let _ = Callback.register "rangeGet" readrange
 let _ = Callback.register "rangeAdd" addtorange
+let _ = Callback.register "rangeFromArray" rangeFromArray
+let _ = Callback.register "rangeToArray" rangeToArray
 let _ = Callback.register "deleteRange" deleterange
  
 type pdfdoc = Pdf.t
@@ -189,14 +241,24 @@ let even r =
 let odd r =
   Array.of_list (keep odd (Array.to_list r))
 
+(* Set operations on ranges, in linear time, using a table of members. Order
+of first appearance is preserved. *)
+let removeDuplicates r =
+  let seen = Hashtbl.create (Array.length r) in
+  let out = ref [] in
+    Array.iter
+      (fun x ->
+         if not (Hashtbl.mem seen x) then
+           begin Hashtbl.add seen x (); out := x :: !out end)
+      r;
+    Array.of_list (rev !out)
+
 let union r r' =
-  Array.of_list (setify (Array.to_list r @ Array.to_list r'))
+  removeDuplicates (Array.append r r')
 
 let difference r r' =
-  Array.of_list (setminus_preserving_order (Array.to_list r) (Array.to_list r'))
-
-let removeDuplicates r =
-  Array.of_list (setify_preserving_order (Array.to_list r))
+  let members = members_of_array r' in
+    Array.of_list (keep (fun x -> not (Hashtbl.mem members x)) (Array.to_list r))
 
 let range a b =
   try new_range (range a b) with e -> handle_error "range" e; err_int
@@ -217,7 +279,7 @@ let removeDuplicates r =
   try new_range (removeDuplicates (lookup_range r)) with e -> handle_error "removeDuplicated" e; err_int
 
 let isInRange r i =
-  try mem i (Array.to_list (lookup_range r)) with e -> handle_error "isInRange" e; err_bool
+  try Hashtbl.mem (lookup_members r) i with e -> handle_error "isInRange" e; err_bool
 
 let _ = Callback.register "range" range
 let _ = Callback.register "even" even
@@ -243,15 +305,33 @@ type encryption_status =
 let initial_encryption_status pdf =
   if Pdfcrypt.is_encrypted pdf then Encrypted else NotEncrypted
 
+(* What a lazily-read PDF is reading from. A Source is a C read function,
+known by a number on the C side. These are released when the PDF is
+deleted. *)
+type source =
+  | Channel of in_channel
+  | Source of int
+
+external release_source : int -> unit = "cpdflib_releaseSource"
+
+let release = function
+  | Channel ch -> close_in ch
+  | Source s -> release_source s
+
 (* Store the PDF and return the integer key *)
 let pdfs = null_hash ()
 
 let pdfkey = ref 0
 
-let new_pdf ?channel pdf =
+let new_pdf ?source pdf =
   incr pdfkey;
-  Hashtbl.add pdfs !pdfkey ([], (pdf, initial_encryption_status pdf, channel), []);
-  !pdfkey
+  let sources = match source with Some s -> [s] | None -> [] in
+    Hashtbl.add pdfs !pdfkey ([], (pdf, initial_encryption_status pdf, sources), []);
+    begin match !scopes with
+    | s::_ -> s.scope_pdfs <- !pdfkey :: s.scope_pdfs
+    | [] -> ()
+    end;
+    !pdfkey
 
 let lookup_pdf i =
   match Hashtbl.find pdfs i with
@@ -262,23 +342,169 @@ let lookup_pdf_status i =
   match Hashtbl.find pdfs i with (_, (_, enc, _), _) -> enc
 
 let set_pdf_status i status =
-  let l, (pdf, _, channel), r = Hashtbl.find pdfs i in
-    Hashtbl.replace pdfs i (l, (pdf, status, channel), r) 
+  let l, (pdf, _, sources), r = Hashtbl.find pdfs i in
+    Hashtbl.replace pdfs i (l, (pdf, status, sources), r) 
+
+(* The pages of each PDF, so that per-page queries need not read the page tree
+each time. An entry is valid only for the same Pdf.t and generation. Each PDF
+has its own generation, incremented by any change to it, so a change to one
+PDF does not invalidate the entries of the others. *)
+let generations = null_hash ()
+
+let generation i =
+  try Hashtbl.find generations i with Not_found -> 0
+
+let changed i =
+  Hashtbl.replace generations i (generation i + 1)
+
+(* For changes made through a Pdf.t, mark each number it is stored under. *)
+let changed_pdf pdf =
+  Hashtbl.iter
+    (fun i (_, (pdf', _, _), _) -> if pdf' == pdf then changed i)
+    pdfs
+
+let page_cache = null_hash ()
+
+let lookup_pages i =
+  let pdf = lookup_pdf i in
+  let fill () =
+    let pages = Array.of_list (Pdfpage.pages_of_pagetree pdf) in
+      Hashtbl.replace page_cache i (pdf, generation i, pages);
+      pages
+  in
+    match Hashtbl.find page_cache i with
+    | (pdf', gen, pages) when pdf' == pdf && gen = generation i -> pages
+    | _ -> fill ()
+    | exception Not_found -> fill ()
+
+let page_count i = Array.length (lookup_pages i)
+
+let lookup_page i pagenumber =
+  let pages = lookup_pages i in
+    if pagenumber < 1 || pagenumber > Array.length pages
+      then failwith "lookup_page: no such page"
+      else pages.(pagenumber - 1)
+
+(* Removing unreferenced objects before writing walks the whole object graph.
+It is skipped if already done for the same Pdf.t and objects at the same
+generation, or if turned off by setRemoveUnreferenced. *)
+let removeUnreferenced = ref true
+
+let unreferenced_removed = null_hash ()
+
+let remove_unreferenced i =
+  let pdf = lookup_pdf i in
+  let remove () =
+    Pdf.remove_unreferenced pdf;
+    Hashtbl.replace unreferenced_removed i (pdf, pdf.Pdf.objects, generation i)
+  in
+    if !removeUnreferenced then
+      match Hashtbl.find unreferenced_removed i with
+      | (pdf', objects, gen)
+          when pdf' == pdf && objects == pdf.Pdf.objects && gen = generation i -> ()
+      | _ -> remove ()
+      | exception Not_found -> remove ()
+
+(* The file each PDF read from a file came from, for incremental update. *)
+let origins = null_hash ()
 
 let delete_pdf i =
+  Hashtbl.remove page_cache i;
+  Hashtbl.remove generations i;
+  Hashtbl.remove unreferenced_removed i;
+  Hashtbl.remove origins i;
   begin try
-    begin match Hashtbl.find pdfs i with
-    | (_, (_, _, Some ch), _) -> close_in ch
-    | _ -> ()
-    end
+    match Hashtbl.find pdfs i with
+    | (_, (_, _, sources), _) -> iter (fun s -> try release s with _ -> ()) sources
   with
     _ -> ()
   end;
   Hashtbl.remove pdfs i
 
+(* The new PDF may still be reading lazily from the old one's sources, so
+they are kept until deletion. *)
 let replace_pdf i pdf =
-  let l, (_, enc, channel), r = Hashtbl.find pdfs i in
-    Hashtbl.replace pdfs i (l, (pdf, enc, None), r)
+  let l, (_, enc, sources), r = Hashtbl.find pdfs i in
+    Hashtbl.replace pdfs i (l, (pdf, enc, sources), r);
+    changed i
+
+(* Move the PDF under number y to number x. Both sets of sources are kept. *)
+let move_pdf x y =
+  changed x;
+  let _, (pdf, _, sources_y), _ = Hashtbl.find pdfs y in
+  let l, (_, enc, sources_x), r = Hashtbl.find pdfs x in
+    Hashtbl.replace pdfs x (l, (pdf, enc, sources_x @ sources_y), r);
+    Hashtbl.remove pdfs y;
+    Hashtbl.remove generations y;
+    begin match Hashtbl.find origins y with
+    | filename -> Hashtbl.replace origins x filename; Hashtbl.remove origins y
+    | exception Not_found -> Hashtbl.remove origins x
+    end
+
+let beginScope () =
+  try
+    scopes := {scope_pdfs = []; scope_ranges = []} :: !scopes
+  with
+    e -> handle_error "beginScope" e; err_unit
+
+(* Delete everything made in the innermost scope which has not already been
+deleted, and end it. *)
+let endScope () =
+  try
+    match !scopes with
+    | [] -> failwith "no scope to end"
+    | s::t ->
+        scopes := t;
+        iter delete_pdf s.scope_pdfs;
+        iter
+          (fun r -> Hashtbl.remove range_members r; Hashtbl.remove ranges r)
+          s.scope_ranges
+  with
+    e -> handle_error "endScope" e; err_unit
+
+let numPdfs () =
+  try Hashtbl.length pdfs with e -> handle_error "numPdfs" e; err_int
+
+let numRanges () =
+  try Hashtbl.length ranges with e -> handle_error "numRanges" e; err_int
+
+(* Memory accounting. The size of a PDF is everything reachable from it,
+counted by a C stub which, unlike Obj.reachable_words, includes the data of
+bigarrays, where stream data is kept. Closures, such as those which read
+lazily, are not followed, so the buffer of each source is added
+separately. A mapped file is not counted, since its pages belong to the
+operating system's cache, and its bigarray is not a plain one. *)
+external reachable_bytes : Obj.t -> int = "cpdflib_reachableBytes"
+
+let source_buffer_bytes = function
+  | Channel _ | Source _ -> 65536
+
+let pdf_bytes i =
+  match Hashtbl.find pdfs i with
+  | (_, (pdf, _, sources), _) ->
+      reachable_bytes (Obj.repr pdf) + fold_left ( + ) 0 (map source_buffer_bytes sources)
+
+let memoryUsage i =
+  try pdf_bytes i with e -> handle_error "memoryUsage" e; err_int
+
+(* Heap size and peak heap size in bytes, minor, major collections and
+compactions, and the numbers of PDFs and ranges. *)
+let memoryStats () =
+  try
+    let s = Gc.quick_stat () in
+    let bytes w = w * (Sys.word_size / 8) in
+      [|bytes s.Gc.heap_words; bytes s.Gc.top_heap_words; s.Gc.minor_collections;
+        s.Gc.major_collections; s.Gc.compactions; Hashtbl.length pdfs;
+        Hashtbl.length ranges|]
+  with
+    e -> handle_error "memoryStats" e; [||]
+
+let _ = Callback.register "memoryUsage" memoryUsage
+let _ = Callback.register "memoryStats" memoryStats
+let _ = Callback.register "beginScope" beginScope
+let _ = Callback.register "endScope" endScope
+let _ = Callback.register "numPdfs" numPdfs
+let _ = Callback.register "numRanges" numRanges
 
 let enumeratePairs = ref []
 
@@ -302,14 +528,60 @@ let enumeratePDFsInfo i =
 let endEnumeratePDFs () =
   try enumeratePairs := [] with e -> handle_error "endEnumeratePDFs" e; err_unit
 
+(* GC controls. A value of zero for a parameter leaves it unchanged. *)
+let setGCParams minor_heap_words space_overhead max_overhead =
+  try
+    let c = Gc.get () in
+      Gc.set
+        {c with
+           Gc.minor_heap_size =
+             if minor_heap_words > 0 then minor_heap_words else c.Gc.minor_heap_size;
+           Gc.space_overhead =
+             if space_overhead > 0 then space_overhead else c.Gc.space_overhead;
+           Gc.max_overhead =
+             if max_overhead > 0 then max_overhead else c.Gc.max_overhead}
+  with
+    e -> handle_error "setGCParams" e; err_unit
+
+(* The size of the major heap just after the last compaction. *)
+let compacted_heap_bytes = ref 0
+
+let heap_bytes () =
+  (Gc.quick_stat ()).Gc.heap_words * (Sys.word_size / 8)
+
+let compact () =
+  Gc.compact ();
+  compacted_heap_bytes := heap_bytes ()
+
+let compactHeap () =
+  try compact () with e -> handle_error "compactHeap" e; err_unit
+
+let fullMajor () =
+  try Gc.full_major () with e -> handle_error "fullMajor" e; err_unit
+
+(* If non-zero, deletePdf compacts the heap when it has grown by at least this
+many bytes since the last compaction. The heap size is kept by the collector,
+so this does not walk the PDF being deleted. *)
+let compactThreshold = ref 0
+
+let setCompactThreshold n =
+  try compactThreshold := n with e -> handle_error "setCompactThreshold" e; err_unit
+
+let _ = Callback.register "setGCParams" setGCParams
+let _ = Callback.register "compactHeap" compactHeap
+let _ = Callback.register "fullMajor" fullMajor
+let _ = Callback.register "setCompactThreshold" setCompactThreshold
+
 let deletePdf i =
-  try delete_pdf i with e -> handle_error "deletePdf" e; err_unit
+  try
+    delete_pdf i;
+    if !compactThreshold > 0 && heap_bytes () - !compacted_heap_bytes >= !compactThreshold
+      then compact ()
+  with
+    e -> handle_error "deletePdf" e; err_unit
 
 let replacePdf x y =
-  try
-    replace_pdf x (lookup_pdf y);
-    delete_pdf y
-  with e -> handle_error "replacePdf" e; err_unit
+  try move_pdf x y with e -> handle_error "replacePdf" e; err_unit
 
 let flatten_encryptionKind = function
   | None | Some Pdfwrite.AlreadyEncrypted -> 0
@@ -347,7 +619,9 @@ let _ = Callback.register "stringOfPagespec" stringOfPagespec
 (* Read a file, no attempt at decryption, unless it's the blank user password. *)
 let fromFile filename userpw =
   try
-    new_pdf (Pdfread.pdf_of_file (Some userpw) None filename)
+    let i = new_pdf (Pdfread.pdf_of_file (Some userpw) None filename) in
+      Hashtbl.replace origins i filename;
+      i
   with
     e -> handle_error "fromFile" e; err_int
 
@@ -368,7 +642,9 @@ let fromFileLazy filename userpw =
   try
     let fh = open_in_bin filename in
       try
-        new_pdf ~channel:fh (Pdfread.pdf_of_channel_lazy (Some userpw) None fh)
+        let i = new_pdf ~source:(Channel fh) (Pdfread.pdf_of_channel_lazy (Some userpw) None fh) in
+          Hashtbl.replace origins i filename;
+          i
       with
         _ -> close_in fh; raise Exit
   with
@@ -385,12 +661,737 @@ let fromMemoryLazy rawbytes userpw =
   with
     e -> handle_error "fromMemoryLazy" e; err_int
 
+(* Map a file into memory read-only, returning its contents. The file is
+unmapped when the bigarray is collected. *)
+external map_file : string -> Pdfio.rawbytes = "cpdflib_mapFile"
+
+(* Read lazily from a memory-mapped file. Objects are parsed straight from the
+mapping, with no seeks or reads, and the pages are shared with any other
+process mapping the same file. Objects still to be read refer to the
+mapping, so it is kept for as long as any PDF, including one made from this
+one by selecting pages or merging, can still reach them. *)
+let fromFileMapped filename userpw =
+  try
+    let rawbytes = map_file filename in
+    let i =
+      new_pdf
+        (Pdfread.pdf_of_input_lazy
+           (Some userpw)
+           None
+           (Pdfio.input_of_bytes (Pdfio.bytes_of_raw rawbytes)))
+    in
+      Hashtbl.replace origins i filename;
+      i
+  with
+    e -> handle_error "fromFileMapped" e; err_int
+
+(* Read from a source, a C function which reads up to a number of bytes at a
+given offset in the file into a given position in the buffer. Raises Failure
+if the C function reports an error. *)
+external read_source : int -> int -> Bytes.t -> int -> int -> int = "cpdflib_readSource"
+
+(* Fill a buffer from a source, calling it again after a short read, until
+the buffer is full or the source returns nothing. *)
+let read_source_fully source offset buf len =
+  let rec fill got =
+    if got >= len then got else
+      match read_source source (offset + got) buf got (len - got) with
+      | 0 -> got
+      | n -> fill (got + n)
+  in
+    fill 0
+
+let source_block_size = 65536
+
+(* Make a Pdfio.input from a source of a given length, reading a block at a
+time. Blocks are aligned, so that reading backwards, as Pdfread does to find
+the trailer, does not re-read for every character. *)
+let input_of_source source length =
+  let buf = Bytes.create source_block_size in
+  let block_start = ref 0 in
+  let block_length = ref 0 in
+  let pos = ref 0 in
+  let offset = ref 0 in
+  let input_char () =
+    if !pos < 0 || !pos >= length then None else
+      begin
+        if !pos < !block_start || !pos >= !block_start + !block_length then
+          begin
+            block_start := !pos / source_block_size * source_block_size;
+            block_length :=
+              read_source_fully
+                source !block_start buf
+                (min source_block_size (length - !block_start))
+          end;
+        if !pos >= !block_start + !block_length then None else
+          let c = Bytes.unsafe_get buf (!pos - !block_start) in
+            incr pos;
+            Some c
+      end
+  in
+    {Pdfio.pos_in = (fun () -> !pos - !offset);
+     Pdfio.seek_in = (fun p -> pos := p + !offset);
+     Pdfio.input_char = input_char;
+     Pdfio.input_byte =
+       (fun () ->
+          match input_char () with
+          | Some c -> int_of_char c
+          | None -> Pdfio.no_more);
+     Pdfio.in_channel_length = length;
+     Pdfio.set_offset = (fun o -> offset := o);
+     Pdfio.caml_channel = None;
+     Pdfio.source = "source"}
+
+(* When read lazily, the source is kept until the PDF is deleted. Otherwise,
+it is released straight away. *)
+let fromSource source length lazy_read userpw =
+  try
+    let i = input_of_source source length in
+      if lazy_read then
+        new_pdf ~source:(Source source) (Pdfread.pdf_of_input_lazy (Some userpw) None i)
+      else
+        let pdf = Pdfread.pdf_of_input (Some userpw) None i in
+          release_source source;
+          new_pdf pdf
+  with
+    e -> release_source source; handle_error "fromSource" e; err_int
+
+(* Incremental update. Objects parsed since reading are compared with those in
+the original file, and those which differ, together with new ones, are
+appended with a new cross-reference section and trailer. Objects never parsed
+cannot have changed, so the work is in proportion to what has been read, not
+to the size of the file. *)
+let same_object orig n obj =
+  let same a b = try compare a b = 0 with Invalid_argument _ -> false in
+    match obj, (try Pdf.lookup_obj orig n with Not_found -> Pdf.Null) with
+    | Pdf.Stream s, (Pdf.Stream s' as obj') ->
+        Pdf.getstream obj;
+        Pdf.getstream obj';
+        begin match !s, !s' with
+        | (d, Pdf.Got b), (d', Pdf.Got b') -> same d d' && same b b'
+        | _ -> false
+        end
+    | obj, obj' -> same obj obj'
+
+let changed_objects pdf orig =
+  let objs = ref [] in
+    Hashtbl.iter
+      (fun n (r, gen) ->
+         match !r with
+         | Pdf.Parsed obj | Pdf.ParsedAlreadyDecrypted obj ->
+             if not (same_object orig n obj) then objs := (n, gen, obj)::!objs
+         | _ -> ())
+      pdf.Pdf.objects.Pdf.pdfobjects;
+    List.sort (fun (a, _, _) (b, _, _) -> compare a b) !objs
+
+(* The offset given by the last startxref, the length of the file, and whether
+it ends with a newline. *)
+let startxref_of_file filename =
+  let ch = open_in_bin filename in
+    try
+      let len = in_channel_length ch in
+      let n = min len 1024 in
+        seek_in ch (len - n);
+        let s = really_input_string ch n in
+          close_in ch;
+          let rec find p =
+            if p < 0 then failwith "toFileIncremental: no startxref"
+            else if String.sub s p 9 = "startxref" then p + 9
+            else find (p - 1)
+          in
+            let p = find (n - 9) in
+              (Scanf.sscanf (String.sub s p (n - p)) " %d" (fun x -> x),
+               len,
+               n > 0 && (s.[n - 1] = '\n' || s.[n - 1] = '\r'))
+    with
+      e -> close_in ch; raise e
+
+let copy_file from_file to_file =
+  let i = open_in_bin from_file in
+  let o = open_out_bin to_file in
+  let buf = Bytes.create 65536 in
+    try
+      let rec copy () =
+        match input i buf 0 65536 with
+        | 0 -> ()
+        | n -> output o buf 0 n; copy ()
+      in
+        copy ();
+        close_in i;
+        close_out o
+    with
+      e -> close_in i; close_out_noerr o; raise e
+
+(* An object as written: the text before any stream data, the stream data,
+and the text after it. Streams are given their true /Length. *)
+let object_parts n gen obj =
+  match obj with
+  | Pdf.Stream _ ->
+      Pdf.getstream obj;
+      begin match obj with
+      | Pdf.Stream {contents = (dict, Pdf.Got data)} ->
+          let dict = Pdf.add_dict_entry dict "/Length" (Pdf.Integer (Pdfio.bytes_size data)) in
+            (Printf.sprintf "%i %i obj\n%s\nstream\n" n gen (Pdfwrite.string_of_pdf dict),
+             Some data,
+             "\nendstream\nendobj\n")
+      | _ -> failwith "string_of_object: stream not available"
+      end
+  | _ ->
+      (Printf.sprintf "%i %i obj\n%s\nendobj\n" n gen (Pdfwrite.string_of_pdf obj), None, "")
+
+let string_of_object n gen obj =
+  match object_parts n gen obj with
+  | (a, Some data, b) -> a ^ Pdfio.string_of_bytes data ^ b
+  | (a, None, b) -> a ^ b
+
+(* Split sorted (number, offset, generation) entries into runs of consecutive
+object numbers, one for each cross-reference subsection. *)
+let rec xref_runs = function
+  | [] -> []
+  | (n, _, _)::_ as l ->
+      let rec take k = function
+        | ((n', _, _) as e)::t when n' = k ->
+            let run, rest = take (k + 1) t in (e::run, rest)
+        | rest -> ([], rest)
+      in
+        let run, rest = take n l in
+          run :: xref_runs rest
+
+(* An entry in a cross-reference section: an object in use at an offset, or a
+free one, linked to the next free object number. *)
+type xref_entry =
+  | InUse of int
+  | Free of int
+
+(* Whether the cross-reference section at the given offset is a stream, rather
+than a classic xref table. *)
+let is_xref_stream filename offset =
+  let ch = open_in_bin filename in
+    try
+      seek_in ch offset;
+      let s = really_input_string ch (min 4 (in_channel_length ch - offset)) in
+        close_in ch;
+        s <> "xref"
+    with
+      e -> close_in ch; raise e
+
+let rec bytes_needed x =
+  if x < 256 then 1 else 1 + bytes_needed (x / 256)
+
+(* The data of a cross-reference stream with /W [1 w 2], for the given
+entries. *)
+let xref_stream_data w entries =
+  let b = Buffer.create (length entries * (w + 3)) in
+  let put width x =
+    for k = width - 1 downto 0 do
+      Buffer.add_char b (Char.chr ((x lsr (8 * k)) land 255))
+    done
+  in
+    iter
+      (fun (_, e, gen) ->
+         match e with
+         | InUse o -> put 1 1; put w o; put 2 gen
+         | Free next -> put 1 0; put w next; put 2 gen)
+      entries;
+    Buffer.contents b
+
+(* Object streams and cross-reference streams of the original are not freed,
+even if no longer in the PDF, since the entries of the original still refer
+to them. *)
+let freeable orig n =
+  match Pdf.lookup_obj orig n with
+  | Pdf.Stream {contents = (dict, _)} ->
+      begin match Pdf.lookup_direct orig "/Type" dict with
+      | Some (Pdf.Name ("/ObjStm" | "/XRef")) -> false
+      | _ -> true
+      end
+  | _ -> true
+  | exception _ -> true
+
+(* Append the new section to the channel, which is at the end of a copy of the
+original. Objects deleted since reading are given free entries, linked from
+object 0. The section is a cross-reference stream if the original's last one
+was. *)
+let write_incremental ch pdf objs deleted orig_size prev len newline xref_stream =
+  seek_out ch len;
+  if not newline then output_string ch "\n";
+  let used = ref [] in
+  iter
+    (fun (n, gen, obj) ->
+       used := (n, InUse (pos_out ch), gen) :: !used;
+       output_string ch (string_of_object n gen obj))
+    objs;
+  let used = !used in
+  let free =
+    match deleted with
+    | [] -> []
+    | (first, _)::_ ->
+        let rec link = function
+          | [] -> []
+          | [(n, gen)] -> [(n, Free 0, gen + 1)]
+          | (n, gen)::((n', _)::_ as t) -> (n, Free n', gen + 1) :: link t
+        in
+          (0, Free first, 65535) :: link deleted
+  in
+  let size =
+    Hashtbl.fold (fun n _ m -> max (n + 1) m) pdf.Pdf.objects.Pdf.pdfobjects orig_size
+  in
+  let size = max size (fold_left (fun m (n, _) -> max (n + 1) m) 0 deleted) in
+  let trailer =
+    fold_left
+      Pdf.remove_dict_entry
+      pdf.Pdf.trailerdict
+      ["/Prev"; "/XRefStm"; "/Type"; "/W"; "/Index"; "/Filter"; "/DecodeParms"; "/Length"]
+  in
+  let with_entries d l = fold_left (fun d (k, v) -> Pdf.add_dict_entry d k v) d l in
+  let sorted l = List.sort (fun (a, _, _) (b, _, _) -> compare a b) l in
+  let xref = pos_out ch in
+    if xref_stream then
+      let entries = sorted ((size, InUse xref, 0) :: used @ free) in
+      let w =
+        fold_left
+          (fun m (_, e, _) -> match e with InUse x | Free x -> max m (bytes_needed x))
+          1 entries
+      in
+      let runs = xref_runs entries in
+      let data = xref_stream_data w entries in
+      let dict =
+        with_entries trailer
+          ["/Type", Pdf.Name "/XRef";
+           "/Size", Pdf.Integer (size + 1);
+           "/Root", Pdf.Indirect pdf.Pdf.root;
+           "/Prev", Pdf.Integer prev;
+           "/W", Pdf.Array [Pdf.Integer 1; Pdf.Integer w; Pdf.Integer 2];
+           "/Index",
+             Pdf.Array
+               (List.flatten
+                 (map
+                   (function
+                    | (n, _, _)::_ as run -> [Pdf.Integer n; Pdf.Integer (length run)]
+                    | [] -> [])
+                   runs));
+           "/Length", Pdf.Integer (String.length data)]
+      in
+        Printf.fprintf ch "%i 0 obj\n%s\nstream\n" size (Pdfwrite.string_of_pdf dict);
+        output_string ch data;
+        Printf.fprintf ch "\nendstream\nendobj\nstartxref\n%i\n%%%%EOF\n" xref
+    else
+      let trailer =
+        with_entries trailer
+          ["/Size", Pdf.Integer size; "/Root", Pdf.Indirect pdf.Pdf.root; "/Prev", Pdf.Integer prev]
+      in
+        output_string ch "xref\n";
+        iter
+          (fun run ->
+             match run with
+             | (n, _, _)::_ ->
+                 Printf.fprintf ch "%i %i\n" n (length run);
+                 iter
+                   (function
+                    | (_, InUse o, gen) -> Printf.fprintf ch "%010i %05i n\r\n" o gen
+                    | (_, Free next, gen) -> Printf.fprintf ch "%010i %05i f\r\n" next gen)
+                   run
+             | [] -> ())
+          (xref_runs (sorted (used @ free)));
+        Printf.fprintf ch "trailer\n%s\nstartxref\n%i\n%%%%EOF\n" (Pdfwrite.string_of_pdf trailer) xref
+
+(* The update is written to a temporary file beside the destination, which is
+then renamed over it, so that the original is never left half-written, even
+when it is itself the destination. *)
+let toFileIncremental i filename =
+  try
+    let origin =
+      try Hashtbl.find origins i with
+        Not_found -> failwith "toFileIncremental: PDF was not read from a file"
+    in
+    let pdf = lookup_pdf i in
+    let objs, deleted, orig_size =
+      let fh = open_in_bin origin in
+        try
+          let orig = Pdfread.pdf_of_channel_lazy None None fh in
+            if Pdf.lookup_direct orig "/Encrypt" orig.Pdf.trailerdict <> None then
+              failwith "toFileIncremental: encrypted PDFs not supported";
+            let objs = changed_objects pdf orig in
+            let deleted =
+              Hashtbl.fold
+                (fun n (_, gen) l ->
+                   if n > 0 && not (Hashtbl.mem pdf.Pdf.objects.Pdf.pdfobjects n) && freeable orig n
+                     then (n, gen)::l
+                     else l)
+                orig.Pdf.objects.Pdf.pdfobjects
+                []
+            in
+            let size =
+              match Pdf.lookup_direct orig "/Size" orig.Pdf.trailerdict with
+              | Some (Pdf.Integer s) -> s
+              | _ -> 0
+            in
+              close_in fh;
+              (objs, List.sort compare deleted, size)
+        with
+          e -> close_in fh; raise e
+    in
+      if filename <> origin || objs <> [] || deleted <> [] then
+        let prev, len, newline = startxref_of_file origin in
+        let xref_stream = is_xref_stream origin prev in
+        let temp = Filename.temp_file ~temp_dir:(Filename.dirname filename) "cpdf" ".pdf" in
+          try
+            copy_file origin temp;
+            if objs <> [] || deleted <> [] then
+              begin
+                let ch = open_out_gen [Open_wronly; Open_binary] 0o666 temp in
+                  try
+                    write_incremental ch pdf objs deleted orig_size prev len newline xref_stream;
+                    close_out ch
+                  with
+                    e -> close_out_noerr ch; raise e
+              end;
+            Sys.rename temp filename
+          with
+            e -> (try Sys.remove temp with _ -> ()); raise e
+  with
+    e -> handle_error "toFileIncremental" e; err_unit
+
+(* Linearization, as described in Annex F of the PDF standard. The file is
+laid out as: header, linearization dictionary, first-page cross-reference
+section and trailer, catalog, hint stream, the objects of the first page, the
+objects of each other page in turn, objects shared between pages, all other
+objects, and the main cross-reference section and trailer. Objects in the
+first-page section take the highest object numbers. *)
+type bitwriter =
+  {bitbuf : Buffer.t;
+   mutable byte : int;
+   mutable nbits : int}
+
+let put_bits w n v =
+  for x = n - 1 downto 0 do
+    w.byte <- (w.byte lsl 1) lor ((v lsr x) land 1);
+    w.nbits <- w.nbits + 1;
+    if w.nbits = 8 then
+      begin
+        Buffer.add_char w.bitbuf (Char.chr w.byte);
+        w.byte <- 0;
+        w.nbits <- 0
+      end
+  done
+
+let align_bits w =
+  if w.nbits > 0 then put_bits w (8 - w.nbits) 0
+
+let rec bits_needed x =
+  if x <= 0 then 0 else 1 + bits_needed (x lsr 1)
+
+let rec refs_of_object acc = function
+  | Pdf.Indirect n -> n::acc
+  | Pdf.Array l -> fold_left refs_of_object acc l
+  | Pdf.Dictionary d -> fold_left (fun acc (_, v) -> refs_of_object acc v) acc d
+  | Pdf.Stream {contents = (d, _)} -> refs_of_object acc d
+  | _ -> acc
+
+let rec renumber_object f = function
+  | Pdf.Indirect n ->
+      begin match f n with Some n' -> Pdf.Indirect n' | None -> Pdf.Null end
+  | Pdf.Array l -> Pdf.Array (map (renumber_object f) l)
+  | Pdf.Dictionary d -> Pdf.Dictionary (map (fun (k, v) -> (k, renumber_object f v)) d)
+  | Pdf.Stream {contents = (d, data)} -> Pdf.Stream (ref (renumber_object f d, data))
+  | x -> x
+
+let dict_entry k = function
+  | Pdf.Dictionary d -> (try Some (List.assoc k d) with Not_found -> None)
+  | _ -> None
+
+(* Page attributes which may be inherited from the page tree, and so must be
+copied to each page when it is given a new parent or must not depend on the
+page tree. *)
+let inheritable = ["/Resources"; "/MediaBox"; "/CropBox"; "/Rotate"]
+
+let rec inherited pdf k n =
+  match dict_entry "/Parent" (Pdf.lookup_obj pdf n) with
+  | Some (Pdf.Indirect p) ->
+      begin match dict_entry k (Pdf.lookup_obj pdf p) with
+      | Some v -> Some v
+      | None -> inherited pdf k p
+      end
+  | _ -> None
+
+(* A page object with the attributes it inherits added to it. *)
+let with_inherited pdf n =
+  fold_left
+    (fun obj k ->
+       if dict_entry k obj <> None then obj else
+         match inherited pdf k n with
+         | Some v -> Pdf.add_dict_entry obj k v
+         | None -> obj)
+    (Pdf.lookup_obj pdf n)
+    inheritable
+
+(* The objects needed to show a page, page object first. Other pages, page
+tree nodes and the catalog are not followed. Attributes inherited from the
+page tree, and the objects they refer to, are included. *)
+let page_closure pdf p =
+  let seen = Hashtbl.create 64 in
+  let order = ref [p] in
+  let is_tree_node n =
+    match Pdf.lookup_direct pdf "/Type" (Pdf.lookup_obj pdf n) with
+    | Some (Pdf.Name ("/Page" | "/Pages")) -> true
+    | _ -> false
+  in
+  let rec visit n =
+    if not (Hashtbl.mem seen n) && n <> pdf.Pdf.root && not (is_tree_node n) then
+      begin
+        Hashtbl.add seen n ();
+        order := n::!order;
+        iter visit (rev (refs_of_object [] (Pdf.lookup_obj pdf n)))
+      end
+  in
+    Hashtbl.add seen p ();
+    let start =
+      match with_inherited pdf p with
+      | Pdf.Dictionary d -> Pdf.Dictionary (List.filter (fun (k, _) -> k <> "/Parent") d)
+      | x -> x
+    in
+      iter visit (rev (refs_of_object [] start));
+      rev !order
+
+let linearize_pdf_to_output make_id pdf (o : Pdfio.output) =
+  let pagerefs = Array.of_list (Pdf.page_reference_numbers pdf) in
+  let npages = Array.length pagerefs in
+    if npages = 0 then failwith "linearize: no pages";
+    (* Classify objects into first page, private to each other page, shared
+    between other pages, and the rest. *)
+    let first = page_closure pdf pagerefs.(0) in
+    let in_first = Hashtbl.create 256 in
+    iter (fun n -> Hashtbl.replace in_first n ()) first;
+    let closures =
+      Array.init npages
+        (fun i ->
+           if i = 0 then [] else
+             List.filter (fun n -> not (Hashtbl.mem in_first n)) (page_closure pdf pagerefs.(i)))
+    in
+    let counts = Hashtbl.create 256 in
+    Array.iter
+      (iter (fun n -> Hashtbl.replace counts n (1 + (try Hashtbl.find counts n with Not_found -> 0))))
+      closures;
+    let shared_index = Hashtbl.create 256 in
+    let shared = ref [] in
+    Array.iter
+      (iter
+        (fun n ->
+           if Hashtbl.find counts n > 1 && not (Hashtbl.mem shared_index n) then
+             begin
+               Hashtbl.add shared_index n (Hashtbl.length shared_index);
+               shared := n::!shared
+             end))
+      closures;
+    let shared = rev !shared in
+    let privates = Array.map (List.filter (fun n -> Hashtbl.find counts n = 1)) closures in
+    let others = ref [] in
+    Pdf.objiter
+      (fun n _ ->
+         if n <> pdf.Pdf.root && not (Hashtbl.mem in_first n) && not (Hashtbl.mem counts n)
+           then others := n::!others)
+      pdf;
+    let others = List.sort compare !others in
+    (* Number the objects: the rest from 1, then the linearization dictionary,
+    catalog, hint stream and first page objects. *)
+    let rest = List.flatten (Array.to_list privates) @ shared @ others in
+    let k = length rest + 1 in
+    let size = k + 3 + length first in
+    let numbers = Hashtbl.create (size * 2) in
+    List.iteri (fun i n -> Hashtbl.add numbers n (i + 1)) rest;
+    Hashtbl.add numbers pdf.Pdf.root (k + 1);
+    List.iteri (fun i n -> Hashtbl.add numbers n (k + 3 + i)) first;
+    let renumber n = try Some (Hashtbl.find numbers n) with Not_found -> None in
+    (* Pages carry their inherited attributes, so that the first page can be
+    drawn without the page tree, which is at the end. *)
+    let is_page = Hashtbl.create (npages * 2) in
+    Array.iter (fun n -> Hashtbl.replace is_page n ()) pagerefs;
+    let object_of n =
+      renumber_object renumber
+        (if Hashtbl.mem is_page n then with_inherited pdf n else Pdf.lookup_obj pdf n)
+    in
+    (* Each object is serialised once and kept until written, so that the
+    data of a stream read lazily is read only once. *)
+    let serialised = Hashtbl.create (size * 2) in
+    let serialise n =
+      match Hashtbl.find serialised n with
+      | s -> s
+      | exception Not_found ->
+          let s = string_of_object (Hashtbl.find numbers n) 0 (object_of n) in
+            Hashtbl.add serialised n s;
+            s
+    in
+    let measure n = String.length (serialise n) in
+    let write n = o.Pdfio.output_string (serialise n); Hashtbl.remove serialised n in
+    let catalog = serialise pdf.Pdf.root in
+    let first_lengths = map measure first in
+    let rest_lengths = map measure rest in
+    (* Fixed-width parts, whose lengths do not depend on the numbers in them. *)
+    let header = Printf.sprintf "%%PDF-%i.%i\n%%\226\227\207\211\n" pdf.Pdf.major pdf.Pdf.minor in
+    let first_page_number = Hashtbl.find numbers pagerefs.(0) in
+    let lindict l hoff hlen e t =
+      Printf.sprintf
+        "%i 0 obj\n<< /Linearized 1 /L %010i /H [ %010i %010i ] /O %i /E %010i /N %i /T %010i >>\nendobj\n"
+        k l hoff hlen first_page_number e npages t
+    in
+    let xref_entry off = Printf.sprintf "%010i 00000 n\r\n" off in
+    let xref_length n = String.length (Printf.sprintf "xref\n%i %i\n" k n) + 20 * n in
+    let id =
+      if make_id then
+        let d =
+          Digest.string
+            (Printf.sprintf "%f %i %i" (Sys.time ()) (length rest)
+              (Random.State.bits (Random.State.make_self_init ())))
+        in
+          Some (Pdf.Array [Pdf.String d; Pdf.String d])
+      else
+        Pdf.lookup_direct pdf "/ID" pdf.Pdf.trailerdict
+    in
+    let trailer_rest =
+      Printf.sprintf " /Root %i 0 R%s%s"
+        (k + 1)
+        (match dict_entry "/Info" pdf.Pdf.trailerdict with
+         | Some info -> " /Info " ^ Pdfwrite.string_of_pdf (renumber_object renumber info)
+         | None -> "")
+        (match id with
+         | Some id -> " /ID " ^ Pdfwrite.string_of_pdf id
+         | None -> "")
+    in
+    let first_trailer prev =
+      Printf.sprintf "trailer\n<< /Size %i /Prev %010i%s >>\nstartxref\n0\n%%%%EOF\n" size prev trailer_rest
+    in
+    let xref1_offset = String.length header + String.length (lindict 0 0 0 0 0) in
+    let pos0 = xref1_offset + xref_length (size - k) + String.length (first_trailer 0) in
+    (* Offsets as they would be without the hint stream, which is how the hint
+    tables give them. *)
+    let offsets start lengths =
+      let pos = ref start in
+        map (fun l -> let p = !pos in pos := !pos + l; p) lengths
+    in
+    let first_start = pos0 + String.length catalog in
+    let first_offsets = offsets first_start first_lengths in
+    let end_first = first_start + fold_left ( + ) 0 first_lengths in
+    let rest_offsets = offsets end_first rest_lengths in
+    let main_xref = end_first + fold_left ( + ) 0 rest_lengths in
+    let offset_of = Hashtbl.create (size * 2) in
+    List.iter2 (Hashtbl.add offset_of) rest rest_offsets;
+    let length_of = Hashtbl.create (size * 2) in
+    List.iter2 (Hashtbl.add length_of) rest rest_lengths;
+    (* Page offset hint table. *)
+    let page_objects i = if i = 0 then length first else length privates.(i) in
+    let page_length i =
+      if i = 0 then end_first - first_start else
+        fold_left ( + ) 0 (map (Hashtbl.find length_of) privates.(i))
+    in
+    let page_shared i =
+      if i = 0 then [] else
+        map (Hashtbl.find shared_index) (List.filter (Hashtbl.mem shared_index) closures.(i))
+    in
+    let all = ilist 0 (npages - 1) in
+    let least f = fold_left min max_int (map f all) in
+    let most f = fold_left max 0 (map f all) in
+    let least_objects = least page_objects in
+    let least_length = least page_length in
+    let objects_bits = bits_needed (most page_objects - least_objects) in
+    let length_bits = bits_needed (most page_length - least_length) in
+    let nshared_bits = bits_needed (most (fun i -> length (page_shared i))) in
+    let shared_id_bits = bits_needed (length shared - 1) in
+    let w = {bitbuf = Buffer.create 1024; byte = 0; nbits = 0} in
+    iter
+      (fun (n, v) -> put_bits w n v)
+      [(32, least_objects); (32, first_start); (16, objects_bits); (32, least_length);
+       (16, length_bits); (32, 0); (16, 0); (32, least_length); (16, length_bits);
+       (16, nshared_bits); (16, shared_id_bits); (16, 0); (16, 1)];
+    let item f = iter f all; align_bits w in
+    item (fun i -> put_bits w objects_bits (page_objects i - least_objects));
+    item (fun i -> put_bits w length_bits (page_length i - least_length));
+    item (fun i -> put_bits w nshared_bits (length (page_shared i)));
+    item (fun i -> iter (put_bits w shared_id_bits) (page_shared i));
+    item (fun i -> put_bits w length_bits (page_length i - least_length));
+    let shared_table_offset = Buffer.length w.bitbuf in
+    (* Shared object hint table. Each group is one object. *)
+    let shared_lengths = map (Hashtbl.find length_of) shared in
+    let least_shared = fold_left min max_int shared_lengths in
+    let shared_bits = bits_needed (fold_left max 0 shared_lengths - least_shared) in
+    iter
+      (fun (n, v) -> put_bits w n v)
+      [(32, (match shared with s::_ -> Hashtbl.find numbers s | [] -> 0));
+       (32, (match shared with s::_ -> Hashtbl.find offset_of s | [] -> 0));
+       (32, 0); (32, length shared); (16, 0);
+       (32, (if shared = [] then 0 else least_shared)); (16, shared_bits)];
+    iter (fun l -> put_bits w shared_bits (l - least_shared)) shared_lengths;
+    align_bits w;
+    iter (fun _ -> put_bits w 1 0) shared;
+    align_bits w;
+    let hintdata = Buffer.contents w.bitbuf in
+    let hint =
+      Printf.sprintf "%i 0 obj\n<< /Length %i /S %i >>\nstream\n%s\nendstream\nendobj\n"
+        (k + 2) (String.length hintdata) shared_table_offset hintdata
+    in
+    (* Real offsets follow. *)
+    let hl = String.length hint in
+    let main_xref = main_xref + hl in
+    let main_xref_string =
+      Printf.sprintf "xref\n0 %i\n0000000000 65535 f\r\n" k
+      ^ String.concat "" (map (fun off -> xref_entry (off + hl)) rest_offsets)
+    in
+    let main_trailer =
+      Printf.sprintf "trailer\n<< /Size %i >>\nstartxref\n%i\n%%%%EOF\n" k xref1_offset
+    in
+    let file_length = main_xref + String.length main_xref_string + String.length main_trailer in
+    let xref1 =
+      Printf.sprintf "xref\n%i %i\n" k (size - k)
+      ^ String.concat ""
+          (map xref_entry
+             ([String.length header; pos0; first_start] @ map (fun off -> off + hl) first_offsets))
+    in
+    let t = main_xref + String.length (Printf.sprintf "xref\n0 %i" k) in
+      iter
+        o.Pdfio.output_string
+        [header; lindict file_length first_start hl (end_first + hl) t; xref1;
+         first_trailer main_xref; catalog; hint];
+      iter write first;
+      iter write rest;
+      o.Pdfio.output_string main_xref_string;
+      o.Pdfio.output_string main_trailer
+
+(* Linearized output never uses object streams, so the object stream options
+apply only when falling back to Pdfwrite. This happens for a PDF which is
+still encrypted, whose objects cannot be renumbered without re-encrypting
+them. *)
+let linearize_to_output
+  ?preserve_objstm ?generate_objstm ?compress_objstm make_id pdf o
+=
+  if Pdfcrypt.is_encrypted pdf
+    then
+      Pdfwrite.pdf_to_output
+        ?preserve_objstm ?generate_objstm ?compress_objstm None make_id pdf o
+    else
+      linearize_pdf_to_output make_id pdf o
+
+let write_linearized
+  ?preserve_objstm ?generate_objstm ?compress_objstm make_id pdf filename
+=
+  let ch = open_out_bin filename in
+    try
+      linearize_to_output
+        ?preserve_objstm ?generate_objstm ?compress_objstm
+        make_id pdf (Pdfio.output_of_channel ch);
+      close_out ch
+    with
+      e -> close_out_noerr ch; raise e
+
+let setRemoveUnreferenced b =
+  try removeUnreferenced := b with e -> handle_error "setRemoveUnreferenced" e; err_unit
+
 (* Simple full write to a file *)
 let toFile pdf filename linearize make_id =
   try
+    remove_unreferenced pdf;
     let pdf = lookup_pdf pdf in
-      Pdf.remove_unreferenced pdf;
-      Pdfwrite.pdf_to_file_options None make_id pdf filename
+      if linearize
+        then write_linearized make_id pdf filename
+        else Pdfwrite.pdf_to_file_options None make_id pdf filename
   with
     e -> handle_error "toFile" e; err_unit
 
@@ -398,21 +1399,27 @@ let toFileExt
   pdf filename linearize make_id preserve_objstm generate_objstm compress_objstm
 =
   try
+    remove_unreferenced pdf;
     let pdf = lookup_pdf pdf in
-      Pdf.remove_unreferenced pdf;
-      Pdfwrite.pdf_to_file_options
-        ~preserve_objstm ~generate_objstm ~compress_objstm
-        None make_id pdf filename
+      if linearize then
+        write_linearized
+          ~preserve_objstm ~generate_objstm ~compress_objstm make_id pdf filename
+      else
+        Pdfwrite.pdf_to_file_options
+          ~preserve_objstm ~generate_objstm ~compress_objstm
+          None make_id pdf filename
   with
     e -> handle_error "toFileExt" e; err_unit
 
 (* Write to memory. *)
 let toFileMemory pdf linearize make_id =
   try
+    remove_unreferenced pdf;
     let pdf = lookup_pdf pdf in
-      Pdf.remove_unreferenced pdf;
       let o, bytes = Pdfio.input_output_of_bytes (100 * 1024) in
-        Pdfwrite.pdf_to_output None make_id pdf o;
+        if linearize
+          then linearize_to_output make_id pdf o
+          else Pdfwrite.pdf_to_output None make_id pdf o;
         Pdfio.raw_of_bytes
           (Pdfio.extract_bytes_from_input_output o bytes)
   with
@@ -422,20 +1429,97 @@ let toFileMemoryExt
   pdf linearize make_id preserve_objstm generate_objstm compress_objstm
 =
   try
+    remove_unreferenced pdf;
     let pdf = lookup_pdf pdf in
-      Pdf.remove_unreferenced pdf;
       let o, bytes = Pdfio.input_output_of_bytes (100 * 1024) in
-        Pdfwrite.pdf_to_output
-          ~preserve_objstm ~generate_objstm ~compress_objstm
-          None make_id pdf o;
+        if linearize then
+          linearize_to_output
+            ~preserve_objstm ~generate_objstm ~compress_objstm make_id pdf o
+        else
+          Pdfwrite.pdf_to_output
+            ~preserve_objstm ~generate_objstm ~compress_objstm
+            None make_id pdf o;
         Pdfio.raw_of_bytes
           (Pdfio.extract_bytes_from_input_output o bytes)
   with
     e -> handle_error "toFileMemoryExt" e; err_data
 
+(* Write to a sink, a C function which is passed the output a chunk at a time.
+The sink is known by a number on the C side, and raises Failure if the C
+function reports an error. *)
+external write_sink : int -> Bytes.t -> int -> unit = "cpdflib_writeSink"
+
+let sink_chunk_size = 65536
+
+(* Make a Pdfio.output which passes full chunks to a sink, together with a
+function to send the last partial one. *)
+let output_of_sink sink =
+  let buf = Bytes.create sink_chunk_size in
+  let fill = ref 0 in
+  let pos = ref 0 in
+  let flush () =
+    if !fill > 0 then begin write_sink sink buf !fill; fill := 0 end
+  in
+  let output_char c =
+    if !fill = sink_chunk_size then flush ();
+    Bytes.unsafe_set buf !fill c;
+    incr fill;
+    incr pos
+  in
+  let output_string s =
+    let l = String.length s in
+    let i = ref 0 in
+      while !i < l do
+        if !fill = sink_chunk_size then flush ();
+        let n = min (l - !i) (sink_chunk_size - !fill) in
+          Bytes.blit_string s !i buf !fill n;
+          fill := !fill + n;
+          pos := !pos + n;
+          i := !i + n
+      done
+  in
+    {Pdfio.pos_out = (fun () -> !pos);
+     Pdfio.seek_out = (fun _ -> failwith "output_of_sink: cannot seek");
+     Pdfio.output_char = output_char;
+     Pdfio.output_byte = (fun b -> output_char (Char.unsafe_chr b));
+     Pdfio.output_string = output_string;
+     Pdfio.out_caml_channel = None;
+     Pdfio.out_channel_length = (fun () -> !pos)},
+    flush
+
+let toSink pdf sink linearize make_id =
+  try
+    remove_unreferenced pdf;
+    let pdf = lookup_pdf pdf in
+      let o, flush = output_of_sink sink in
+        if linearize
+          then linearize_to_output make_id pdf o
+          else Pdfwrite.pdf_to_output None make_id pdf o;
+        flush ()
+  with
+    e -> handle_error "toSink" e; err_unit
+
+let toSinkExt
+  pdf sink linearize make_id preserve_objstm generate_objstm compress_objstm
+=
+  try
+    remove_unreferenced pdf;
+    let pdf = lookup_pdf pdf in
+      let o, flush = output_of_sink sink in
+        if linearize then
+          linearize_to_output
+            ~preserve_objstm ~generate_objstm ~compress_objstm make_id pdf o
+        else
+          Pdfwrite.pdf_to_output
+            ~preserve_objstm ~generate_objstm ~compress_objstm
+            None make_id pdf o;
+        flush ()
+  with
+    e -> handle_error "toSinkExt" e; err_unit
+
 (* Number of pages in a PDF *)
 let pages i =
-  try Pdfpage.endpage (lookup_pdf i) with
+  try page_count i with
     e -> handle_error "pages" e; err_int
 
 (* Get the number of pages in file. Doesn't need decryption. *)
@@ -443,15 +1527,111 @@ let endpage_io ?revision i user_pw owner_pw =
   let pdf = Pdfread.pdf_of_input_lazy ?revision user_pw owner_pw i in
     Pdfpage.endpage pdf
 
+(* A bounded cache of page counts for pagesFast. A file is known by its name,
+length and modification time. A SHA-256 digest of the password is part of
+the key, so that a wrong one still fails, without the password itself being
+kept. Entries are kept in a list from most to least recently used, and when
+the cache is full the last is dropped. Documents in memory are not cached,
+since only a digest of the whole document would tell two apart reliably, and
+computing one costs more than the count. *)
+type pagecount_key = CachedFile of string * string * int * float
+
+type pagecount_entry =
+  {pagecount_key : pagecount_key;
+   pagecount : int;
+   mutable newer : pagecount_entry option;
+   mutable older : pagecount_entry option}
+
+let pagecount_cache : (pagecount_key, pagecount_entry) Hashtbl.t = Hashtbl.create 64
+
+let pagecount_newest = ref None
+
+let pagecount_oldest = ref None
+
+let pagecount_cache_size = ref 0
+
+let pagecount_hits = ref 0
+
+let pagecount_misses = ref 0
+
+let unlink_pagecount e =
+  begin match e.newer with
+  | Some n -> n.older <- e.older
+  | None -> pagecount_newest := e.older
+  end;
+  begin match e.older with
+  | Some o -> o.newer <- e.newer
+  | None -> pagecount_oldest := e.newer
+  end;
+  e.newer <- None;
+  e.older <- None
+
+let push_pagecount e =
+  e.older <- !pagecount_newest;
+  begin match !pagecount_newest with
+  | Some n -> n.newer <- Some e
+  | None -> pagecount_oldest := Some e
+  end;
+  pagecount_newest := Some e
+
+let setPagesFastCache n =
+  try
+    pagecount_cache_size := max 0 n;
+    Hashtbl.reset pagecount_cache;
+    pagecount_newest := None;
+    pagecount_oldest := None;
+    pagecount_hits := 0;
+    pagecount_misses := 0
+  with
+    e -> handle_error "setPagesFastCache" e; err_unit
+
+let pagesFastCacheHits () =
+  try !pagecount_hits with e -> handle_error "pagesFastCacheHits" e; err_int
+
+let pagesFastCacheMisses () =
+  try !pagecount_misses with e -> handle_error "pagesFastCacheMisses" e; err_int
+
+let cached_pagecount key f =
+  if !pagecount_cache_size = 0 then f () else
+    match Hashtbl.find pagecount_cache key with
+    | e ->
+        incr pagecount_hits;
+        unlink_pagecount e;
+        push_pagecount e;
+        e.pagecount
+    | exception Not_found ->
+        incr pagecount_misses;
+        let n = f () in
+          if Hashtbl.length pagecount_cache >= !pagecount_cache_size then
+            begin match !pagecount_oldest with
+            | Some o -> unlink_pagecount o; Hashtbl.remove pagecount_cache o.pagecount_key
+            | None -> ()
+            end;
+          let e = {pagecount_key = key; pagecount = n; newer = None; older = None} in
+            Hashtbl.add pagecount_cache key e;
+            push_pagecount e;
+            n
+
+(* The length and modification time of a file, in C. *)
+external file_identity : string -> int * float = "cpdflib_fileIdentity"
+
 let pagesFast password filename =
   try
-    let channel = open_in_bin filename in
-      try
-        let r = endpage_io (Pdfio.input_of_channel channel) (Some password) None in
-          close_in channel;
-          r
-      with
-        _ -> close_in channel; raise Exit
+    let count () =
+      let channel = open_in_bin filename in
+        try
+          let r = endpage_io (Pdfio.input_of_channel channel) (Some password) None in
+            close_in channel;
+            r
+        with
+          _ -> close_in channel; raise Exit
+    in
+      if !pagecount_cache_size = 0 then count () else
+        match file_identity filename with
+        | (length, mtime) ->
+            let password = Pdfcryptprimitives.sha256 (Pdfio.input_of_string password) in
+              cached_pagecount (CachedFile (filename, password, length, mtime)) count
+        | exception Failure _ -> count ()
   with
     e -> handle_error "pagesfast" e; err_int
 
@@ -537,6 +1717,9 @@ let decryptPdfOwner i p =
     with
       e -> handle_error "decryptPdfOwner" e; err_unit
 
+(* The linearize argument is accepted for compatibility, but encrypted output
+is never linearized. Encryption keys depend on object numbers, which the
+linearizer chooses, and Pdfwrite, which encrypts, lays out the file itself. *)
 let toFileEncrypted_inner
   ?(preserve_objstm = true) ?(generate_objstm = false)
   ?(compress_objstm = true)
@@ -596,7 +1779,7 @@ let read_perms perms =
 
 let toFileEncrypted i mthd perms user owner linearize makeid filename =
   try
-    Pdf.remove_unreferenced (lookup_pdf i);
+    remove_unreferenced i;
     toFileEncrypted_inner
       (lookup_pdf i) (read_method mthd) (read_perms perms) user owner linearize makeid filename
   with
@@ -604,8 +1787,8 @@ let toFileEncrypted i mthd perms user owner linearize makeid filename =
 
 let toFileMemoryEncrypted i mthd perms user owner linearize makeid =
   try
+    remove_unreferenced i;
     let pdf = lookup_pdf i in
-      Pdf.remove_unreferenced pdf;
       let o, bytes = Pdfio.input_output_of_bytes (100 * 1024) in
         toFileMemoryEncrypted_inner
           (lookup_pdf i) (read_method mthd) (read_perms perms) user owner linearize makeid o;
@@ -619,7 +1802,7 @@ let toFileEncryptedExt
   preserve_objstm generate_objstm compress_objstm filename
 =
   try
-    Pdf.remove_unreferenced (lookup_pdf i);
+    remove_unreferenced i;
     toFileEncrypted_inner
       ~preserve_objstm ~generate_objstm ~compress_objstm
       (lookup_pdf i) (read_method mthd) (read_perms perms) user owner linearize makeid filename
@@ -631,8 +1814,8 @@ let toFileMemoryEncryptedExt
   preserve_objstm generate_objstm compress_objstm
 =
   try
+    remove_unreferenced i;
     let pdf = lookup_pdf i in
-      Pdf.remove_unreferenced pdf;
       let o, bytes = Pdfio.input_output_of_bytes (100 * 1024) in
         toFileMemoryEncrypted_inner
           ~preserve_objstm ~generate_objstm ~compress_objstm
@@ -646,17 +1829,26 @@ let _ = Callback.register "fromFile" fromFile
 let _ = Callback.register "fromFileLazy" fromFileLazy
 let _ = Callback.register "fromMemory" fromMemory
 let _ = Callback.register "fromMemoryLazy" fromMemoryLazy
+let _ = Callback.register "fromSource" fromSource
+let _ = Callback.register "fromFileMapped" fromFileMapped
 let _ = Callback.register "decryptPdf" decryptPdf
 let _ = Callback.register "decryptPdfOwner" decryptPdfOwner
+let _ = Callback.register "setRemoveUnreferenced" setRemoveUnreferenced
 let _ = Callback.register "toFile" toFile
+let _ = Callback.register "toFileIncremental" toFileIncremental
 let _ = Callback.register "toFileExt" toFileExt
 let _ = Callback.register "toFileMemory" toFileMemory
 let _ = Callback.register "toFileMemoryExt" toFileMemoryExt
+let _ = Callback.register "toSink" toSink
+let _ = Callback.register "toSinkExt" toSinkExt
 let _ = Callback.register "toFileMemoryEncrypted" toFileMemoryEncrypted
 let _ = Callback.register "toFileMemoryEncryptedExt" toFileMemoryEncryptedExt
 let _ = Callback.register "pages" pages
 let _ = Callback.register "pagesFast" pagesFast
 let _ = Callback.register "pagesFastMemory" pagesFastMemory
+let _ = Callback.register "setPagesFastCache" setPagesFastCache
+let _ = Callback.register "pagesFastCacheHits" pagesFastCacheHits
+let _ = Callback.register "pagesFastCacheMisses" pagesFastCacheMisses
 let _ = Callback.register "all" all
 let _ = Callback.register "isEncrypted" isEncrypted
 let _ = Callback.register "toFileEncrypted" toFileEncrypted
@@ -722,7 +1914,413 @@ let selectPages pdf range =
   with
     e -> handle_error "selectPages" e; err_int
 
+(* Streaming merge. The pages of each input, and everything they refer to, are
+renumbered and written to the sink as the input arrives, so only the offsets
+of the objects written so far and the numbers of their pages are kept.
+Document-level structures, such as bookmarks and forms, are not carried over.
+Object 1 is the root of the page tree, and object 2 the catalog. Both are
+written at the end. *)
+type streaming_merge =
+  {merge_output : Pdfio.output;
+   merge_flush : unit -> unit;
+   merge_sink : int;
+   mutable merge_offsets : int array;
+   mutable merge_next : int;
+   mutable merge_pages : int list;
+   mutable merge_version : int * int;
+   mutable merge_deduplicate : bool;
+   merge_hashes : (string, int) Hashtbl.t}
+
+let merges = null_hash ()
+
+let mergekey = ref 0
+
+let lookup_merge i =
+  try Hashtbl.find merges i with Not_found -> failwith "lookup_merge: not found"
+
+let set_merge_offset m n offset =
+  let l = Array.length m.merge_offsets in
+    if n >= l then
+      begin
+        let a = Array.make (max (n + 1) (l * 2)) 0 in
+          Array.blit m.merge_offsets 0 a 0 l;
+          m.merge_offsets <- a
+      end;
+    m.merge_offsets.(n) <- offset
+
+let new_merge o flush sink =
+  o.Pdfio.output_string "%PDF-1.4\n%\226\227\207\211\n";
+  {merge_output = o;
+   merge_flush = flush;
+   merge_sink = sink;
+   merge_offsets = Array.make 1024 0;
+   merge_next = 3;
+   merge_pages = [];
+   merge_version = (1, 4);
+   merge_deduplicate = false;
+   merge_hashes = Hashtbl.create 256}
+
+let mergeBegin sink =
+  try
+    let o, flush = output_of_sink sink in
+      incr mergekey;
+      Hashtbl.add merges !mergekey (new_merge o flush sink);
+      !mergekey
+  with
+    e -> handle_error "mergeBegin" e; err_int
+
+(* Every object is serialised before any is written, so a damaged input
+leaves the output as it was. Only the pages in the page tree are taken. Other
+page objects, and the page tree itself, are not followed. *)
+let merge_append m pdf =
+  let pages = Pdf.page_reference_numbers pdf in
+  let is_page = Hashtbl.create 64 in
+  iter (fun n -> Hashtbl.replace is_page n ()) pages;
+  let object_of n =
+    if Hashtbl.mem is_page n then with_inherited pdf n else Pdf.lookup_obj pdf n
+  in
+  let is_tree_node n =
+    match Pdf.lookup_direct pdf "/Type" (Pdf.lookup_obj pdf n) with
+    | Some (Pdf.Name "/Pages") -> true
+    | Some (Pdf.Name "/Page") -> not (Hashtbl.mem is_page n)
+    | _ -> false
+  in
+  let numbers = Hashtbl.create 256 in
+  let next = ref m.merge_next in
+  let number n = Hashtbl.add numbers n !next; incr next in
+  let renumber n = try Some (Hashtbl.find numbers n) with Not_found -> None in
+  let order = ref [] in
+  let visiting = Hashtbl.create 64 in
+  let finished = Hashtbl.create 256 in
+  let bodies = Hashtbl.create 64 in
+  let hashes = Hashtbl.create 64 in
+  let find_hash h =
+    try Some (Hashtbl.find hashes h) with Not_found ->
+      try Some (Hashtbl.find m.merge_hashes h) with Not_found -> None
+  in
+  (* Objects are numbered after their children, so that a resource may be
+  hashed with its references already resolved. An object met again while its
+  children are being visited is part of a cycle, and is numbered at once, and
+  never shared. *)
+  let rec visit shareable n =
+    if is_tree_node n || Hashtbl.mem finished n then () else
+    if Hashtbl.mem visiting n then
+      (if not (Hashtbl.mem numbers n) then number n)
+    else
+      begin
+        Hashtbl.add visiting n ();
+        begin match object_of n with
+        | Pdf.Dictionary d when Hashtbl.mem is_page n ->
+            iter
+              (fun (k, v) -> iter (visit (k = "/Resources")) (rev (refs_of_object [] v)))
+              d
+        | obj ->
+            iter (visit shareable) (rev (refs_of_object [] obj))
+        end;
+        Hashtbl.remove visiting n;
+        Hashtbl.add finished n ();
+        if Hashtbl.mem numbers n || not shareable || not m.merge_deduplicate then
+          begin
+            if not (Hashtbl.mem numbers n) then number n;
+            order := n::!order
+          end
+        else
+          let body = string_of_object 0 0 (renumber_object renumber (object_of n)) in
+          let h = Pdfcryptprimitives.sha256 (Pdfio.input_of_string body) in
+            match find_hash h with
+            | Some existing -> Hashtbl.add numbers n existing
+            | None ->
+                number n;
+                Hashtbl.add hashes h (Hashtbl.find numbers n);
+                Hashtbl.add bodies n body;
+                order := n::!order
+      end
+  in
+    (* A page given more than once is written once for each time, so that
+    each entry in the page tree is a distinct object. *)
+    let page_numbers = ref [] in
+    let copies = ref [] in
+    iter
+      (fun n ->
+         if Hashtbl.mem numbers n then
+           begin
+             copies := (!next, n) :: !copies;
+             page_numbers := !next :: !page_numbers;
+             incr next
+           end
+         else
+           begin
+             number n;
+             page_numbers := Hashtbl.find numbers n :: !page_numbers
+           end)
+      pages;
+    iter (visit false) pages;
+    let page_string num n =
+      string_of_object num 0
+        (Pdf.add_dict_entry (renumber_object renumber (object_of n)) "/Parent" (Pdf.Indirect 1))
+    in
+    let strings =
+      map
+        (fun n ->
+           let num = Hashtbl.find numbers n in
+             match Hashtbl.find bodies n with
+             | body ->
+                 (num, Printf.sprintf "%i 0 obj" num ^ String.sub body 7 (String.length body - 7))
+             | exception Not_found ->
+                 if Hashtbl.mem is_page n then (num, page_string num n) else
+                   (num, string_of_object num 0 (renumber_object renumber (object_of n))))
+        (rev !order)
+      @ map (fun (num, n) -> (num, page_string num n)) (rev !copies)
+    in
+      iter
+        (fun (n, s) ->
+           set_merge_offset m n (m.merge_output.Pdfio.pos_out ());
+           m.merge_output.Pdfio.output_string s)
+        strings;
+      Hashtbl.iter (Hashtbl.replace m.merge_hashes) hashes;
+      m.merge_next <- !next;
+      m.merge_pages <- !page_numbers @ m.merge_pages;
+      m.merge_version <- max m.merge_version (pdf.Pdf.major, pdf.Pdf.minor)
+
+(* In deduplicating mode, a resource whose serialised form, with references
+resolved, is the same as one already written is not written again, and
+references to it are pointed at the first copy. Only the digest and number
+of each resource written are kept. *)
+let mergeDeduplicate i b =
+  try (lookup_merge i).merge_deduplicate <- b with
+    e -> handle_error "mergeDeduplicate" e; err_unit
+
+let decrypt_for_merge userpw pdf =
+  if not (Pdfcrypt.is_encrypted pdf) then pdf else
+    match Pdfcrypt.decrypt_pdf userpw pdf with
+    | Some pdf, _ -> pdf
+    | None, _ -> failwith "merge: could not decrypt"
+
+let mergeAppendFile i filename userpw =
+  try
+    let m = lookup_merge i in
+    let ch = open_in_bin filename in
+      try
+        merge_append m (decrypt_for_merge userpw (Pdfread.pdf_of_channel_lazy (Some userpw) None ch));
+        close_in ch
+      with
+        e -> close_in ch; raise e
+  with
+    e -> handle_error "mergeAppendFile" e; err_unit
+
+let mergeAppendMemory i rawbytes userpw =
+  try
+    let m = lookup_merge i in
+      merge_append m
+        (decrypt_for_merge userpw
+          (Pdfread.pdf_of_input_lazy (Some userpw) None
+            (Pdfio.input_of_bytes (Pdfio.bytes_of_raw rawbytes))))
+  with
+    e -> handle_error "mergeAppendMemory" e; err_unit
+
+(* Write the page tree, catalog, cross-reference table and trailer. *)
+let finish_merge m =
+  let o = m.merge_output in
+  let kids = rev m.merge_pages in
+  let major, minor = m.merge_version in
+  let write n obj =
+    set_merge_offset m n (o.Pdfio.pos_out ());
+    o.Pdfio.output_string (string_of_object n 0 obj)
+  in
+    write 1
+      (Pdf.Dictionary
+         [("/Type", Pdf.Name "/Pages");
+          ("/Kids", Pdf.Array (map (fun n -> Pdf.Indirect n) kids));
+          ("/Count", Pdf.Integer (length kids))]);
+    write 2
+      (Pdf.Dictionary
+         ([("/Type", Pdf.Name "/Catalog"); ("/Pages", Pdf.Indirect 1)] @
+          (if (major, minor) > (1, 4)
+             then [("/Version", Pdf.Name (Printf.sprintf "/%i.%i" major minor))]
+             else [])));
+    let xref = o.Pdfio.pos_out () in
+    let id = Digest.string (Printf.sprintf "%f %i" (Sys.time ()) m.merge_next) in
+      o.Pdfio.output_string (Printf.sprintf "xref\n0 %i\n0000000000 65535 f\r\n" m.merge_next);
+      for n = 1 to m.merge_next - 1 do
+        o.Pdfio.output_string (Printf.sprintf "%010i 00000 n\r\n" m.merge_offsets.(n))
+      done;
+      o.Pdfio.output_string
+        (Printf.sprintf "trailer\n%s\nstartxref\n%i\n%%%%EOF\n"
+           (Pdfwrite.string_of_pdf
+              (Pdf.Dictionary
+                 [("/Size", Pdf.Integer m.merge_next);
+                  ("/Root", Pdf.Indirect 2);
+                  ("/ID", Pdf.Array [Pdf.String id; Pdf.String id])]))
+           xref);
+      m.merge_flush ()
+
+(* Returns the sink, even on error, so the C side may release it. *)
+let mergeEnd i =
+  match Hashtbl.find merges i with
+  | exception Not_found -> handle_error "mergeEnd" (Failure "lookup_merge: not found"); err_int
+  | m ->
+      try
+        Hashtbl.remove merges i;
+        finish_merge m;
+        m.merge_sink
+      with
+        e -> handle_error "mergeEnd" e; m.merge_sink
+
+(* Split to files, one for each range. In the filename, @N is replaced by the
+number of the output, counting from one, and @S and @E by its first and last
+pages. *)
+let split_filename template n pages =
+  let subst s (pat, rep) =
+    let b = Buffer.create (String.length s) in
+    let l = String.length pat in
+    let rec go i =
+      if i > String.length s - l then Buffer.add_string b (String.sub s i (String.length s - i))
+      else if String.sub s i l = pat then (Buffer.add_string b rep; go (i + l))
+      else (Buffer.add_char b s.[i]; go (i + 1))
+    in
+      go 0;
+      Buffer.contents b
+  in
+    fold_left
+      subst
+      template
+      [("@N", string_of_int n);
+       ("@S", string_of_int (hd pages));
+       ("@E", string_of_int (last pages))]
+
+(* Each part is written as selectPages followed by toFile would write it, so
+that the document information, bookmarks, forms and other document-level
+structures of its pages are kept. Everything is checked before the first file
+is written. *)
+let split_to_files pdf parts template =
+  if Pdfcrypt.is_encrypted pdf then failwith "split: PDF is encrypted";
+  let endpage = Pdfpage.endpage pdf in
+    iter
+      (fun pages ->
+         if pages = [] then failwith "split: empty range";
+         iter (fun p -> if p < 1 || p > endpage then failwith "split: page not found") pages)
+      parts;
+    let filenames = List.mapi (fun n pages -> split_filename template (n + 1) pages) parts in
+      if length (setify filenames) < length filenames then
+        failwith "split: filename template gives more than one part the same name, use @N";
+      List.iter2
+        (fun pages filename ->
+           let part = Pdfpage.pdf_of_pages ~retain_numbering:true pdf pages in
+             Pdf.remove_unreferenced part;
+             Pdfwrite.pdf_to_file_options None false part filename)
+        parts
+        filenames
+
+let splitToFiles i ranges template =
+  try
+    split_to_files
+      (lookup_pdf i) (map (fun r -> Array.to_list (lookup_range r)) (Array.to_list ranges)) template
+  with
+    e -> handle_error "splitToFiles" e; err_unit
+
+(* Estimate the size an object will have when written, without forcing
+streams which have not yet been read. *)
+let object_cost pdf n =
+  match Pdf.lookup_obj pdf n with
+  | Pdf.Stream {contents = (dict, data)} ->
+      let length =
+        match data with
+        | Pdf.Got b -> Pdfio.bytes_size b
+        | Pdf.ToGet _ ->
+            match Pdf.lookup_direct pdf "/Length" dict with Some (Pdf.Integer l) -> l | _ -> 0
+      in
+        String.length (Pdfwrite.string_of_pdf dict) + length + 60
+  | obj -> String.length (Pdfwrite.string_of_pdf obj) + 40
+
+(* Divide a run of pages into parts whose estimated size is at most maxbytes,
+in one pass. A page costs the objects it uses which are not already in the
+current part, so shared resources are counted once per part. A page too
+large on its own is given a part to itself. *)
+let split_by_size pdf maxbytes pages =
+  let refs = Array.of_list (Pdf.page_reference_numbers pdf) in
+  let costs = Hashtbl.create 1024 in
+  let cost n =
+    try Hashtbl.find costs n with Not_found ->
+      let c = object_cost pdf n in Hashtbl.add costs n c; c
+  in
+  let overhead = 400 in
+  let parts = ref [] in
+  let current = ref [] in
+  let contents = Hashtbl.create 256 in
+  let size = ref overhead in
+    iter
+      (fun p ->
+         if p < 1 || p > Array.length refs then failwith "split: page not found";
+         let closure = page_closure pdf refs.(p - 1) in
+         let added ns =
+           fold_left (fun a n -> if Hashtbl.mem contents n then a else a + cost n) 20 ns
+         in
+         let extra = added closure in
+           if !current <> [] && !size + extra > maxbytes then
+             begin
+               parts := rev !current :: !parts;
+               current := [];
+               Hashtbl.clear contents;
+               size := overhead + added closure
+             end
+           else
+             size := !size + extra;
+           current := p :: !current;
+           iter (fun n -> Hashtbl.replace contents n ()) closure)
+      pages;
+    if !current <> [] then parts := rev !current :: !parts;
+    rev !parts
+
+let splitToFilesBySize i maxbytes template =
+  try
+    if maxbytes <= 0 then failwith "splitToFilesBySize: bad size";
+    let pdf = lookup_pdf i in
+      split_to_files pdf (split_by_size pdf maxbytes (ilist 1 (Pdfpage.endpage pdf))) template
+  with
+    e -> handle_error "splitToFilesBySize" e; err_unit
+
+(* Start a new part at each page with a bookmark at the given level. Parts
+larger than maxbytes, if it is not zero, are divided further by size. *)
+let splitToFilesOnBookmarks i level maxbytes template =
+  try
+    let pdf = lookup_pdf i in
+    let endpage = Pdfpage.endpage pdf in
+    let starts =
+      setify
+        (1 ::
+          option_map
+            (fun m ->
+               if m.Pdfmarks.level = level then
+                 match Pdfpage.pagenumber_of_target pdf m.Pdfmarks.target with
+                 | p when p >= 1 && p <= endpage -> Some p
+                 | _ -> None
+               else
+                 None)
+            (Pdfmarks.read_bookmarks ~preserve_actions:false pdf))
+    in
+    let starts = List.sort compare starts in
+    let rec parts = function
+      | [] -> []
+      | [s] -> [ilist s endpage]
+      | s::(s'::_ as more) -> ilist s (s' - 1) :: parts more
+    in
+    let parts = if endpage = 0 then [] else parts starts in
+    let parts =
+      if maxbytes > 0 then List.flatten (map (split_by_size pdf maxbytes) parts) else parts
+    in
+      split_to_files pdf parts template
+  with
+    e -> handle_error "splitToFilesOnBookmarks" e; err_unit
+
 let _ = Callback.register "mergeSimple" mergeSimple
+let _ = Callback.register "mergeBegin" mergeBegin
+let _ = Callback.register "mergeAppendFile" mergeAppendFile
+let _ = Callback.register "mergeDeduplicate" mergeDeduplicate
+let _ = Callback.register "mergeAppendMemory" mergeAppendMemory
+let _ = Callback.register "mergeEnd" mergeEnd
+let _ = Callback.register "splitToFiles" splitToFiles
+let _ = Callback.register "splitToFilesBySize" splitToFilesBySize
+let _ = Callback.register "splitToFilesOnBookmarks" splitToFilesOnBookmarks
 let _ = Callback.register "merge" merge
 let _ = Callback.register "mergeSame" mergeSame
 let _ = Callback.register "selectPages" selectPages
@@ -749,6 +2347,7 @@ let bl0_1, bl0_2, bl0_3 = 0., 0., 7
 (* For turning functions which return a new PDF into ones which update the given
 pdf. The PDF which is newly created should be thrown away. *)
 let update_pdf (copyfrom : Pdf.t) (copyto : Pdf.t) =
+  changed_pdf copyto;
   copyto.Pdf.major <- copyfrom.Pdf.major;
   copyto.Pdf.minor <- copyfrom.Pdf.minor;
   copyto.Pdf.root <- copyfrom.Pdf.root;
@@ -945,8 +2544,69 @@ let _ = Callback.register "showBoxes" showBoxes
 let _ = Callback.register "hardBox" hardBox
 
 (* CHAPTER 5. Compression *)
+
+(* Deflate each of an array of buffers at the given level, using the given
+number of threads, in C. Each buffer is compressed on its own, so the result
+does not depend upon the number of threads. *)
+external deflate_many : Pdfio.rawbytes array -> int -> int -> Pdfio.rawbytes array = "cpdflib_deflateMany"
+
+let compressionThreads = ref 1
+
+let setCompressionThreads n =
+  try
+    if n < 1 then failwith "setCompressionThreads: must be at least one";
+    compressionThreads := n
+  with
+    e -> handle_error "setCompressionThreads" e; err_unit
+
+(* Compress as Cpdfsqueeze.recompress_pdf does: every stream without a filter,
+other than metadata, is deflated, and an encrypted PDF is left alone. The
+streams are gathered first and deflated all at once, on as many threads as
+requested, so the output is the same for any number of threads. *)
+let compress_parallel pdf =
+  let streams = ref [] in
+    if not (Pdfcrypt.is_encrypted pdf) then
+      Pdf.iter_stream
+        (function
+         | Pdf.Stream ({contents = (dict, _)} as s) as stream ->
+             begin match Pdf.lookup_direct pdf "/Filter" dict, Pdf.lookup_direct pdf "/Type" dict with
+             | _, Some (Pdf.Name "/Metadata") -> ()
+             | (None | Some (Pdf.Array [])), _ -> Pdf.getstream stream; streams := s::!streams
+             | _ -> ()
+             end
+         | _ -> ())
+        pdf;
+    let streams = Array.of_list (rev !streams) in
+    let data =
+      Array.map
+        (fun s -> match !s with (_, Pdf.Got d) -> Pdfio.raw_of_bytes d | _ -> assert false)
+        streams
+    in
+      let compressed = deflate_many data !Pdfcodec.flate_level !compressionThreads in
+        Array.iteri
+          (fun n s ->
+             let d = Pdfio.bytes_of_raw compressed.(n) in
+             let dict = fst !s in
+             let filter =
+               match Pdf.lookup_direct pdf "/Filter" dict with
+               | Some (Pdf.Array a) -> Pdf.Array (Pdf.Name "/FlateDecode"::a)
+               | _ -> Pdf.Name "/FlateDecode"
+             in
+             let dict = Pdf.add_dict_entry dict "/Filter" filter in
+             let dict =
+               match Pdf.lookup_direct pdf "/DecodeParms" dict with
+               | Some (Pdf.Array a) -> Pdf.add_dict_entry dict "/DecodeParms" (Pdf.Array (Pdf.Null::a))
+               | _ -> dict
+             in
+             let dict = Pdf.add_dict_entry dict "/Length" (Pdf.Integer (Pdfio.bytes_size d)) in
+               s := (dict, Pdf.Got d))
+          streams;
+        pdf
+
 let compress pdf =
-  try update_pdf (Cpdfsqueeze.recompress_pdf (lookup_pdf pdf)) (lookup_pdf pdf) with
+  try
+    update_pdf (compress_parallel (lookup_pdf pdf)) (lookup_pdf pdf)
+  with
     e -> handle_error "compress" e; err_unit
 
 let decompress pdf =
@@ -954,6 +2614,7 @@ let decompress pdf =
     e -> handle_error "decompress" e; err_unit
 
 let _ = Callback.register "compress" compress
+let _ = Callback.register "setCompressionThreads" setCompressionThreads
 let _ = Callback.register "decompress" decompress
 
 (* CHAPTER 6. Bookmarks *)
@@ -1185,6 +2846,7 @@ let addText_inner
   in
     if not metrics then
       begin
+        changed_pdf pdf;
         pdf.Pdf.root <- newpdf.Pdf.root;
         pdf.Pdf.objects <- newpdf.Pdf.objects;
         pdf.Pdf.trailerdict <- newpdf.Pdf.trailerdict
@@ -1322,7 +2984,7 @@ let _ = Callback.register "chopV" chopV
 (* CHAPTER 10. Annotations *)
 let annotationsJSON pdf =
   try
-    Pdfio.raw_of_bytes (Cpdfannot.get_annotations_json (lookup_pdf pdf) (ilist 1 (Pdfpage.endpage (lookup_pdf pdf))))
+    Pdfio.raw_of_bytes (Cpdfannot.get_annotations_json (lookup_pdf pdf) (ilist 1 (page_count pdf)))
   with
     e -> handle_error "annotationsJSON" e; err_data
 
@@ -1334,6 +2996,7 @@ let removeAnnotations pdf range =
 
 let setAnnotationsJSON pdf data =
   try
+    changed pdf;
     let i = Pdfio.input_of_bytes (Pdfio.bytes_of_raw data) in
       Cpdfannot.set_annotations_json (lookup_pdf pdf) i
   with
@@ -1427,7 +3090,7 @@ let fontinfo = ref [||]
 (* Actually get the font info and store in an array. *)
 let startGetFontInfo pdf =
   try
-    fontinfo := Array.of_list (Cpdffont.list_fonts (lookup_pdf pdf) (ilist 1 (Pdfpage.endpage (lookup_pdf pdf))))
+    fontinfo := Array.of_list (Cpdffont.list_fonts (lookup_pdf pdf) (ilist 1 (page_count pdf)))
   with
     e -> handle_error "startGetFontInfo" e; err_unit
 
@@ -1452,7 +3115,7 @@ let getFontEncoding serial =
 
 let fontsJSON pdf =
   try
-    Pdfio.raw_of_bytes (Pdfio.bytes_of_string (Cpdfyojson.Safe.pretty_to_string (Cpdffont.json_fonts (lookup_pdf pdf) (ilist 1 (Pdfpage.endpage (lookup_pdf pdf))))))
+    Pdfio.raw_of_bytes (Pdfio.bytes_of_string (Cpdfyojson.Safe.pretty_to_string (Cpdffont.json_fonts (lookup_pdf pdf) (ilist 1 (page_count pdf)))))
   with
     e -> handle_error "fontsJSON" e; err_data
 
@@ -1593,12 +3256,14 @@ let dateStringOfComponents year month day hour minute second hour_offset minute_
 
 let setVersion pdf version =
   try
+    changed pdf;
     (lookup_pdf pdf).Pdf.minor <- version
   with
     e -> handle_error "setVersion" e; err_unit
 
 let setFullVersion pdf major minor =
   try
+    changed pdf;
     (lookup_pdf pdf).Pdf.major <- major;
     (lookup_pdf pdf).Pdf.minor <- minor
   with
@@ -1998,15 +3663,13 @@ let hasBox pdf pagenumber boxname =
 
 let getPageRotation pdf pagenumber =
   try 
-    let pages = Pdfpage.pages_of_pagetree (lookup_pdf pdf) in
-      Pdfpage.int_of_rotation (List.nth pages (pagenumber - 1)).Pdfpage.rotate
+    Pdfpage.int_of_rotation (lookup_page pdf pagenumber).Pdfpage.rotate
   with
     e -> handle_error "getPageRotation" e; err_int
 
 let numAnnots pdf pagenumber =
   try 
-    let pages = Pdfpage.pages_of_pagetree (lookup_pdf pdf) in
-    let page = List.nth pages (pagenumber - 1) in
+    let page = lookup_page pdf pagenumber in
       match Pdf.lookup_direct (lookup_pdf pdf) "/Annots" page.Pdfpage.rest with
       | Some (Pdf.Array a) -> length a
       | _ -> 0
@@ -2026,44 +3689,42 @@ type page_info =
    artbox : box;
    trimbox : box}
 
-let getPageInfo pdf =
-  Array.of_list
-    (map
-       (function (page : Pdfpage.t) ->
-         let m_minx, m_miny, m_maxx, m_maxy =
-           match page.Pdfpage.mediabox with
-           | Pdf.Array [a; b; c; d] ->
-               Pdf.getnum pdf a, Pdf.getnum pdf b, Pdf.getnum pdf c, Pdf.getnum pdf d
-           | _ -> 0., 0., 0., 0.
-         in
-           let c_minx, c_miny, c_maxx, c_maxy =
-             match Pdf.lookup_direct pdf "/CropBox" page.Pdfpage.rest with
-             | Some (Pdf.Array [a; b; c; d]) ->
-                 Pdf.getnum pdf a, Pdf.getnum pdf b, Pdf.getnum pdf c, Pdf.getnum pdf d
-             | _ -> m_minx, m_miny, m_maxx, m_maxy
-           in
-             let getotherbox name =
-               match Pdf.lookup_direct pdf name page.Pdfpage.rest with
-                 | Some (Pdf.Array [a; b; c; d]) ->
-                     Pdf.getnum pdf a, Pdf.getnum pdf b, Pdf.getnum pdf c, Pdf.getnum pdf d
-                 | _ -> c_minx, c_miny, c_maxx, c_maxy
-             in
-             let t_minx, t_miny, t_maxx, t_maxy = getotherbox "/TrimBox"
-             in let a_minx, a_miny, a_maxx, a_maxy = getotherbox "/ArtBox"
-             in let b_minx, b_miny, b_maxx, b_maxy = getotherbox "/BleedBox"
-             in
-               {pimediabox = {minx = m_minx; maxx = m_maxx; miny = m_miny; maxy = m_maxy};
-                cropbox = {minx = c_minx; maxx = c_maxx; miny = c_miny; maxy = c_maxy};
-                trimbox = {minx = t_minx; maxx = t_maxx; miny = t_miny; maxy = t_maxy};
-                artbox = {minx = a_minx; maxx = a_maxx; miny = a_miny; maxy = a_maxy};
-                bleedbox = {minx = b_minx; maxx = b_maxx; miny = b_miny; maxy = b_maxy}}
-       )
-       (Pdfpage.pages_of_pagetree pdf))
+let page_info_of_page pdf (page : Pdfpage.t) =
+  let m_minx, m_miny, m_maxx, m_maxy =
+    match page.Pdfpage.mediabox with
+    | Pdf.Array [a; b; c; d] ->
+        Pdf.getnum pdf a, Pdf.getnum pdf b, Pdf.getnum pdf c, Pdf.getnum pdf d
+    | _ -> 0., 0., 0., 0.
+  in
+    let c_minx, c_miny, c_maxx, c_maxy =
+      match Pdf.lookup_direct pdf "/CropBox" page.Pdfpage.rest with
+      | Some (Pdf.Array [a; b; c; d]) ->
+          Pdf.getnum pdf a, Pdf.getnum pdf b, Pdf.getnum pdf c, Pdf.getnum pdf d
+      | _ -> m_minx, m_miny, m_maxx, m_maxy
+    in
+      let getotherbox name =
+        match Pdf.lookup_direct pdf name page.Pdfpage.rest with
+          | Some (Pdf.Array [a; b; c; d]) ->
+              Pdf.getnum pdf a, Pdf.getnum pdf b, Pdf.getnum pdf c, Pdf.getnum pdf d
+          | _ -> c_minx, c_miny, c_maxx, c_maxy
+      in
+      let t_minx, t_miny, t_maxx, t_maxy = getotherbox "/TrimBox"
+      in let a_minx, a_miny, a_maxx, a_maxy = getotherbox "/ArtBox"
+      in let b_minx, b_miny, b_maxx, b_maxy = getotherbox "/BleedBox"
+      in
+        {pimediabox = {minx = m_minx; maxx = m_maxx; miny = m_miny; maxy = m_maxy};
+         cropbox = {minx = c_minx; maxx = c_maxx; miny = c_miny; maxy = c_maxy};
+         trimbox = {minx = t_minx; maxx = t_maxx; miny = t_miny; maxy = t_maxy};
+         artbox = {minx = a_minx; maxx = a_maxx; miny = a_miny; maxy = a_maxy};
+         bleedbox = {minx = b_minx; maxx = b_maxx; miny = b_miny; maxy = b_maxy}}
+
+let getPageInfo pdf pagenumber =
+  page_info_of_page (lookup_pdf pdf) (lookup_page pdf pagenumber)
 
 let getMediaBox pdf pagenumber =
   try 
     let box =
-      (getPageInfo (lookup_pdf pdf)).(pagenumber - 1).pimediabox
+      (getPageInfo pdf pagenumber).pimediabox
     in
       box.minx, box.maxx, box.miny, box.maxy
   with
@@ -2072,7 +3733,7 @@ let getMediaBox pdf pagenumber =
 let getCropBox pdf pagenumber =
   try
     let box =
-      (getPageInfo (lookup_pdf pdf)).(pagenumber - 1).cropbox
+      (getPageInfo pdf pagenumber).cropbox
     in
       box.minx, box.maxx, box.miny, box.maxy
   with
@@ -2081,7 +3742,7 @@ let getCropBox pdf pagenumber =
 let getTrimBox pdf pagenumber =
   try
     let box =
-      (getPageInfo (lookup_pdf pdf)).(pagenumber - 1).trimbox
+      (getPageInfo pdf pagenumber).trimbox
     in
       box.minx, box.maxx, box.miny, box.maxy
   with
@@ -2090,7 +3751,7 @@ let getTrimBox pdf pagenumber =
 let getArtBox pdf pagenumber =
   try
     let box =
-      (getPageInfo (lookup_pdf pdf)).(pagenumber - 1).artbox
+      (getPageInfo pdf pagenumber).artbox
     in
       box.minx, box.maxx, box.miny, box.maxy
   with
@@ -2099,12 +3760,52 @@ let getArtBox pdf pagenumber =
 let getBleedBox pdf pagenumber =
   try
     let box =
-      (getPageInfo (lookup_pdf pdf)).(pagenumber - 1).bleedbox
+      (getPageInfo pdf pagenumber).bleedbox
     in
       box.minx, box.maxx, box.miny, box.maxy
   with
     e -> handle_error "getBleedBox" e; err_box
 
+(* The geometry of each page in a range, from one walk of the page tree, as a
+flat array of floats, page_geometry_fields to a page: the page number; the
+media, crop, trim, art and bleed boxes as min x, max x, min y, max y; the
+rotation; and the number of annotations, fonts and XObjects. The C side
+unpacks this into an array of structs. *)
+let page_geometry_fields = 25
+
+let getPageGeometry pdf range =
+  try
+    let pages = lookup_pages pdf in
+    let pdf = lookup_pdf pdf in
+    let range = lookup_range range in
+    let out = Array.make (Array.length range * page_geometry_fields) 0. in
+      Array.iteri
+        (fun i pagenumber ->
+           let page = pages.(pagenumber - 1) in
+           let info = page_info_of_page pdf page in
+           let set n x = out.(i * page_geometry_fields + n) <- x in
+           let setbox n b = set n b.minx; set (n + 1) b.maxx; set (n + 2) b.miny; set (n + 3) b.maxy in
+           let count dict key =
+             match Pdf.lookup_direct pdf key dict with
+             | Some (Pdf.Array a) -> length a
+             | Some (Pdf.Dictionary d) -> length d
+             | _ -> 0
+           in
+             set 0 (float_of_int pagenumber);
+             setbox 1 info.pimediabox;
+             setbox 5 info.cropbox;
+             setbox 9 info.trimbox;
+             setbox 13 info.artbox;
+             setbox 17 info.bleedbox;
+             set 21 (float_of_int (Pdfpage.int_of_rotation page.Pdfpage.rotate));
+             set 22 (float_of_int (count page.Pdfpage.rest "/Annots"));
+             set 23 (float_of_int (count page.Pdfpage.resources "/Font"));
+             set 24 (float_of_int (count page.Pdfpage.resources "/XObject")))
+        range;
+      out
+  with
+    e -> handle_error "getPageGeometry" e; [||]
+
 let setArtBox pdf range minx maxx miny maxy =
   try
     update_pdf (Cpdfpage.setBox "/ArtBox" minx maxx miny maxy (lookup_pdf pdf) (Array.to_list (lookup_range range))) (lookup_pdf pdf)
@@ -2131,7 +3832,7 @@ let setCropBox pdf range minx maxx miny maxy =
 
 let pageInfoJSON pdf =
   try
-    Pdfio.raw_of_bytes (Pdfio.bytes_of_string (Cpdfyojson.Safe.pretty_to_string (Cpdfpage.json_page_info (lookup_pdf pdf) (ilist 1 (Pdfpage.endpage (lookup_pdf pdf))) Pdfunits.PdfPoint)))
+    Pdfio.raw_of_bytes (Pdfio.bytes_of_string (Cpdfyojson.Safe.pretty_to_string (Cpdfpage.json_page_info (lookup_pdf pdf) (ilist 1 (page_count pdf)) Pdfunits.PdfPoint)))
   with
     e -> handle_error "pageInfoJSON" e; err_data
 
@@ -2195,6 +3896,7 @@ let _ = Callback.register "getCropBox" getCropBox
 let _ = Callback.register "getArtBox" getArtBox
 let _ = Callback.register "getTrimBox" getTrimBox
 let _ = Callback.register "getBleedBox" getBleedBox
+let _ = Callback.register "getPageGeometry" getPageGeometry
 let _ = Callback.register "setArtBox" setArtBox
 let _ = Callback.register "setCropBox" setCropBox
 let _ = Callback.register "setTrimBox" setTrimBox
@@ -2314,7 +4016,7 @@ let imagejson = ref `Null
 
 let startGetImages pdf =
   try
-    imagejson := Cpdfimage.images ~inline:false (lookup_pdf pdf) (ilist 1 (Pdfpage.endpage (lookup_pdf pdf)));
+    imagejson := Cpdfimage.images ~inline:false (lookup_pdf pdf) (ilist 1 (page_count pdf));
     match !imagejson with `List l -> length l | _ -> 0
   with e ->
     handle_error "startGetImages" e; err_int
@@ -2440,7 +4142,7 @@ let images = ref [||]
 let startGetImageResolution pdf res = 
   images :=
     Array.of_list
-      (Cpdfimage.image_resolution ~inline:true (lookup_pdf pdf) (ilist 1 (Pdfpage.endpage (lookup_pdf pdf))) res);
+      (Cpdfimage.image_resolution ~inline:true (lookup_pdf pdf) (ilist 1 (page_count pdf)) res);
   Array.length !images
 
 let endGetImageResolution () =
@@ -2490,13 +4192,13 @@ let getImageResolutionObjNum serial =
 
 let imageResolutionJSON pdf res =
   try
-    Pdfio.raw_of_bytes (Cpdfimage.image_resolution_json ~inline:false (lookup_pdf pdf) (ilist 1 (Pdfpage.endpage (lookup_pdf pdf))) res)
+    Pdfio.raw_of_bytes (Cpdfimage.image_resolution_json ~inline:false (lookup_pdf pdf) (ilist 1 (page_count pdf)) res)
   with
     e -> handle_error "imageResolutionJSON" e; err_data
 
 let imagesJSON pdf =
   try
-    Pdfio.raw_of_bytes (Pdfio.bytes_of_string (Cpdfyojson.Safe.pretty_to_string (Cpdfimage.images ~inline:false (lookup_pdf pdf) (ilist 1 (Pdfpage.endpage (lookup_pdf pdf))))))
+    Pdfio.raw_of_bytes (Pdfio.bytes_of_string (Cpdfyojson.Safe.pretty_to_string (Cpdfimage.images ~inline:false (lookup_pdf pdf) (ilist 1 (page_count pdf)))))
   with
     e -> handle_error "imagesJSON" e; err_data
 
@@ -2537,12 +4239,14 @@ let addPageLabels pdf style prefix offset range progress =
     and prefix =
       if prefix = "" then None else Some (Pdftext.pdfdocstring_of_utf8 prefix)
     in
+      changed pdf;
       Cpdfpagelabels.add_page_labels (lookup_pdf pdf) progress style prefix offset (Array.to_list (lookup_range range))
   with
     e -> handle_error "addPageLabels" e; err_unit
 
 let removePageLabels pdf =
   try
+    changed pdf;
     Pdfpagelabels.remove (lookup_pdf pdf)
   with
     e -> handle_error "removePageLabels\n" e; err_unit
@@ -2690,6 +4394,7 @@ let _ = Callback.register "endGetOCGList" endGetOCGList
 
 let ocgCoalesce pdf =
   try
+    changed pdf;
     Cpdfocg.ocg_coalesce (lookup_pdf pdf)
   with
     e -> handle_error "ocgCoalesce" e; err_unit
@@ -2698,6 +4403,7 @@ let _ = Callback.register "OCGCoalesce" ocgCoalesce
 
 let ocgRename pdf f t =
   try
+    changed pdf;
     Cpdfocg.ocg_rename f t (lookup_pdf pdf) 
   with
     e -> handle_error "ocgRename" e; err_unit
@@ -2706,6 +4412,7 @@ let _ = Callback.register "OCGRename" ocgRename
 
 let ocgOrderAll pdf =
   try
+    changed pdf;
     Cpdfocg.ocg_order_all (lookup_pdf pdf)
   with
     e -> handle_error "ocgOrderAll" e; err_unit
@@ -3207,30 +4914,35 @@ let removeAllText pdf range =
 
 let removeId pdf =
   try
+    changed pdf;
     (lookup_pdf pdf).Pdf.trailerdict <- Pdf.remove_dict_entry (lookup_pdf pdf).Pdf.trailerdict "/ID"
   with
     e -> handle_error "removeId" e; err_unit
 
 let removeDictEntry pdf key =
   try
+    changed pdf;
     Cpdfutil.remove_dict_entry (lookup_pdf pdf) key None
   with
     e -> handle_error "removeDictEntry" e; err_unit
 
 let removeDictEntrySearch pdf key searchterm =
   try
+    changed pdf;
     Cpdfutil.remove_dict_entry (lookup_pdf pdf) key (Some (Cpdfjson.object_of_json (Cpdfyojson.Safe.from_string searchterm)))
   with
     e -> handle_error "removeDictEntrySearch" e; err_unit
 
 let replaceDictEntry pdf key value =
   try
+    changed pdf;
     Cpdfutil.replace_dict_entry (lookup_pdf pdf) key (Cpdfjson.object_of_json (Cpdfyojson.Safe.from_string value)) None
   with
     e -> handle_error "replaceDictEntry" e; err_unit
 
 let replaceDictEntrySearch pdf key value searchterm =
   try
+    changed pdf;
     let a = lookup_pdf pdf in
     let b = (Cpdfjson.object_of_json (Cpdfyojson.Safe.from_string value)) in
     let c = (Some (Cpdfjson.object_of_json (Cpdfyojson.Safe.from_string searchterm))) in
@@ -3265,6 +4977,64 @@ let _ = Callback.register "replaceDictEntrySearch" replaceDictEntrySearch
 let _ = Callback.register "getDictEntries" getDictEntries
 let _ = Callback.register "removeClipping" removeClipping
 
+(* Contexts. The state of each startGet... to endGet... sequence, and the
+stack of scopes, is held in global references. A context is a saved copy of
+all of them, so that several such sequences may be in progress at once, one
+in each context. Switching context saves the current state into the old
+context and restores the new one. Context 0 is the one in use at startup,
+and cannot be deleted. *)
+let save_context () =
+  let e = !enumeratePairs and b = !bookmarkinfo and sb = !setbookmarkinfo
+  and s = !subformats and f = !fontinfo and a = !attachments
+  and ij = !imagejson and i = !images and l = !labels and o = !ocgnamelist
+  and sc = !scopes in
+    (fun () ->
+       enumeratePairs := e; bookmarkinfo := b; setbookmarkinfo := sb;
+       subformats := s; fontinfo := f; attachments := a; imagejson := ij;
+       images := i; labels := l; ocgnamelist := o; scopes := sc)
+
+let empty_context () =
+  enumeratePairs := []; bookmarkinfo := [||]; setbookmarkinfo := [||];
+  subformats := []; fontinfo := [||]; attachments := []; imagejson := `Null;
+  images := [||]; labels := [||]; ocgnamelist := [||]; scopes := []
+
+let contexts = null_hash ()
+
+let contextkey = ref 0
+
+let currentContext = ref 0
+
+let _ = Hashtbl.add contexts 0 empty_context
+
+let newContext () =
+  try
+    incr contextkey;
+    Hashtbl.add contexts !contextkey empty_context;
+    !contextkey
+  with
+    e -> handle_error "newContext" e; err_int
+
+let setContext i =
+  try
+    if i <> !currentContext then
+      let restore = Hashtbl.find contexts i in
+        Hashtbl.replace contexts !currentContext (save_context ());
+        restore ();
+        currentContext := i
+  with
+    e -> handle_error "setContext" e; err_unit
+
+let deleteContext i =
+  try
+    if i = 0 || i = !currentContext then failwith "context in use" else
+      if not (Hashtbl.mem contexts i) then raise Not_found else
+        Hashtbl.remove contexts i
+  with
+    e -> handle_error "deleteContext" e; err_unit
+
+let _ = Callback.register "newContext" newContext
+let _ = Callback.register "setContext" setContext
+let _ = Callback.register "deleteContext" deleteContext
 
 let onexit () =
   Printf.printf "There are %i ranges on exit:\n" (Hashtbl.length ranges);
@@ -2,6 +2,9 @@
 val getLastError : unit -> int
 val getLastErrorString : unit -> string
 val clearError : unit -> unit
+val newContext : unit -> int
+val setContext : int -> unit
+val deleteContext : int -> unit
 
 (* CHAPTER 1. Basics *)
 type pdf
@@ -16,6 +19,16 @@ val startEnumeratePDFs : unit -> int
 val enumeratePDFsKey : int -> int
 val enumeratePDFsInfo : int -> string
 val endEnumeratePDFs : unit -> unit
+val beginScope : unit -> unit
+val endScope : unit -> unit
+val numPdfs : unit -> int
+val numRanges : unit -> int
+val memoryUsage : pdf -> int
+val memoryStats : unit -> int array
+val setGCParams : int -> int -> int -> unit
+val compactHeap : unit -> unit
+val fullMajor : unit -> unit
+val setCompactThreshold : int -> unit
 val deletePdf : int -> unit
 val deleterange : int -> unit
 val onexit : unit -> unit
@@ -35,6 +48,8 @@ val writerange : range -> int -> int -> unit
 val readrange : range -> int -> int
 val lengthrange : range -> int
 val addtorange : range -> int -> range
+val rangeFromArray : int array -> range
+val rangeToArray : range -> int array
 val even : range -> range
 val odd : range -> range
 val union : range -> range -> range
@@ -45,13 +60,22 @@ val fromFile : string -> string -> pdf
 val fromFileLazy : string -> string -> pdf
 val fromMemory : Pdfio.rawbytes -> string -> int
 val fromMemoryLazy : Pdfio.rawbytes -> string -> int
+val fromSource : int -> int -> bool -> string -> int
+val fromFileMapped : string -> string -> int
+val setRemoveUnreferenced : bool -> unit
 val toFile : pdf -> string -> bool -> bool -> unit
+val toFileIncremental : pdf -> string -> unit
 val toFileExt : pdf -> string -> bool -> bool -> bool -> bool -> bool -> unit
 val toFileMemory : pdf -> bool -> bool -> Pdfio.rawbytes
 val toFileMemoryExt : pdf -> bool -> bool -> bool -> bool -> bool -> Pdfio.rawbytes
+val toSink : pdf -> int -> bool -> bool -> unit
+val toSinkExt : pdf -> int -> bool -> bool -> bool -> bool -> bool -> unit
 val pages : pdf -> int
 val pagesFast : string -> string -> int
 val pagesFastMemory : string -> Pdfio.rawbytes -> int
+val setPagesFastCache : int -> unit
+val pagesFastCacheHits : unit -> int
+val pagesFastCacheMisses : unit -> int
 val all : pdf -> int
 val isEncrypted : pdf -> bool
 val decryptPdf : pdf -> string -> unit
@@ -68,6 +92,14 @@ val mergeSimple : pdf array -> pdf
 val merge : pdf array -> bool -> bool -> pdf
 val mergeSame : pdf array -> bool -> bool -> int array -> pdf
 val selectPages : pdf -> range -> pdf
+val mergeBegin : int -> int
+val mergeDeduplicate : int -> bool -> unit
+val mergeAppendFile : int -> string -> string -> unit
+val mergeAppendMemory : int -> Pdfio.rawbytes -> string -> unit
+val mergeEnd : int -> int
+val splitToFiles : pdf -> range array -> string -> unit
+val splitToFilesBySize : pdf -> int -> string -> unit
+val splitToFilesOnBookmarks : pdf -> int -> int -> string -> unit
 
 (* CHAPTER 3. Pages *)
 val scalePages : pdf -> range -> float -> float -> unit
@@ -93,6 +125,7 @@ val getMediaBox : pdf -> int -> float * float * float * float
 val getCropBox : pdf -> int -> float * float * float * float
 val getArtBox : pdf -> int -> float * float * float * float
 val getBleedBox : pdf -> int -> float * float * float * float
+val getPageGeometry : pdf -> range -> float array
 val getTrimBox : pdf -> int -> float * float * float * float
 val removeCrop : pdf -> range -> unit
 val removeArt : pdf -> range -> unit
@@ -105,6 +138,7 @@ val showBoxes : pdf -> range -> unit
 (* CHAPTER 4. Encryption and Decryption *)
 
 (* CHAPTER 5. Compression *)
+val setCompressionThreads : int -> unit
 val compress : pdf -> unit
 val decompress : pdf -> unit
 val squeezeInMemory : pdf -> unit
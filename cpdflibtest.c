@@ -2,11 +2,23 @@
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
 #include "cpdflibwrapper.h"
 
+/* A sink which writes to a file */
+int writefile(void *file, const void *data, size_t length) {
+  return fwrite(data, 1, length, file) != length;
+}
+
+/* A source which reads from a buffer in memory */
+int readbuffer(void *buffer, size_t offset, void *data, int length) {
+  memcpy(data, (char *)buffer + offset, length);
+  return length;
+}
+
 void prerr(void) {
   if (cpdf_lastError > 0)
     printf("(%i | %s)\n", cpdf_lastError, cpdf_lastErrorString);
@@ -40,6 +52,23 @@ int main(int argc, char **argv) {
   printf("---cpdf_clearError()\n");
   cpdf_clearError();
   prerr();
+  printf("---cpdf_setThreadSafe()\n");
+  cpdf_setThreadSafe(true);
+  cpdf_fromFile("nonexistent.pdf", "");
+  printf("error = %i\n", cpdf_fLastError());
+  cpdf_clearError();
+  cpdf_setThreadSafe(false);
+  prerr();
+  printf("---cpdf_newContext()\n");
+  int context = cpdf_newContext();
+  prerr();
+  printf("---cpdf_setContext()\n");
+  cpdf_setContext(context);
+  cpdf_setContext(0);
+  prerr();
+  printf("---cpdf_deleteContext()\n");
+  cpdf_deleteContext(context);
+  prerr();
 
   /* CHAPTER 1. Basics */
   printf("***** CHAPTER 1. Basics\n");
@@ -52,16 +81,75 @@ int main(int argc, char **argv) {
   int buflen;
   printf("---cpdf_toMemory()\n");
   void *buf = cpdf_toMemory(f, false, false, &buflen);
+  printf("---cpdf_setZeroCopy()\n");
+  cpdf_setZeroCopy(true);
+  int zerocopylen;
+  void *zerocopybuf = cpdf_toMemory(f, false, false, &zerocopylen);
+  cpdf_setZeroCopy(false);
+  prerr();
+  printf("---cpdf_releaseBuffer()\n");
+  cpdf_releaseBuffer(zerocopybuf);
+  prerr();
   printf("---cpdf_fromMemory()\n");
   int frommem = cpdf_fromMemory(buf, buflen, "");
   cpdf_toFile(frommem, "testoutputs/01fromMemory.pdf", false, false);
   prerr();
+  printf("---cpdf_setRemoveUnreferenced()\n");
+  cpdf_setRemoveUnreferenced(false);
+  cpdf_toFile(frommem, "testoutputs/01noRemoveUnreferenced.pdf", false, false);
+  cpdf_setRemoveUnreferenced(true);
+  prerr();
   printf("---cpdf_fromMemoryLazy()\n");
   int frommemlazy = cpdf_fromMemoryLazy(buf, buflen, "");
   prerr();
   cpdf_toFile(frommemlazy, "testoutputs/01fromMemoryLazy.pdf", false, false);
+  size_t buflen64;
+  printf("---cpdf_toMemory64()\n");
+  void *buf64 = cpdf_toMemory64(f, false, false, &buflen64);
+  prerr();
+  printf("---cpdf_fromMemory64()\n");
+  int frommem64 = cpdf_fromMemory64(buf64, buflen64, "");
+  prerr();
+  printf("---cpdf_fromMemoryLazy64()\n");
+  int frommemlazy64 = cpdf_fromMemoryLazy64(buf64, buflen64, "");
+  prerr();
+  cpdf_toFile(frommemlazy64, "testoutputs/01fromMemoryLazy64.pdf", false,
+              false);
+  printf("---cpdf_fromSource()\n");
+  int fromsource = cpdf_fromSource(readbuffer, buflen64, buf64, true, "");
+  prerr();
+  cpdf_toFile(fromsource, "testoutputs/01fromSource.pdf", false, false);
+  cpdf_deletePdf(fromsource);
+  printf("---cpdf_fromFileMapped()\n");
+  int frommapped = cpdf_fromFileMapped("cpdflibmanual.pdf", "");
+  prerr();
+  cpdf_toFile(frommapped, "testoutputs/01fromFileMapped.pdf", false, false);
+  cpdf_deletePdf(frommapped);
+  printf("---cpdf_memoryUsage()\n");
+  printf("memory usage is non-zero: %i\n", cpdf_memoryUsage(f) > 0);
+  prerr();
+  printf("---cpdf_memoryStats()\n");
+  struct cpdf_memoryStats stats;
+  cpdf_memoryStats(&stats);
+  prerr();
+  printf("heap is non-zero: %i\n", stats.heap_bytes > 0);
+  printf("---cpdf_setGCParams()\n");
+  cpdf_setGCParams(262144, 120, 0);
+  prerr();
+  printf("---cpdf_setCompactThreshold()\n");
+  cpdf_setCompactThreshold(1);
+  prerr();
+  cpdf_deletePdf(frommem64);
+  cpdf_setCompactThreshold(0);
+  cpdf_deletePdf(frommemlazy64);
   cpdf_deletePdf(f);
   prerr();
+  printf("---cpdf_fullMajor()\n");
+  cpdf_fullMajor();
+  prerr();
+  printf("---cpdf_compactHeap()\n");
+  cpdf_compactHeap();
+  prerr();
   cpdf_replacePdf(f2, frommem);
   prerr();
   printf("---cpdf: enumerate PDFs\n");
@@ -75,6 +163,16 @@ int main(int argc, char **argv) {
   }
   cpdf_endEnumeratePDFs();
   prerr();
+  printf("---cpdf_beginScope()\n");
+  cpdf_beginScope();
+  cpdf_blankDocument(100.0, 200.0, 20);
+  cpdf_range(1, 10);
+  prerr();
+  printf("%i PDFs, %i ranges\n", cpdf_numPdfs(), cpdf_numRanges());
+  printf("---cpdf_endScope()\n");
+  cpdf_endScope();
+  prerr();
+  printf("%i PDFs, %i ranges\n", cpdf_numPdfs(), cpdf_numRanges());
   printf("---cpdf_ptOfIn()\n");
   printf("One inch is %f points\n", cpdf_ptOfIn(1.0));
   prerr();
@@ -123,6 +221,17 @@ int main(int argc, char **argv) {
   printf("---cpdf_rangeAdd()\n");
   int range_add = cpdf_rangeAdd(range_all, 20);
   prerr();
+  printf("---cpdf_rangeFromArray()\n");
+  int range_pages[3] = {5, 1, 3};
+  int range_from_array = cpdf_rangeFromArray(range_pages, 3);
+  prerr();
+  printf("---cpdf_rangeToArray()\n");
+  int range_out[3];
+  int range_out_len = cpdf_rangeToArray(range_from_array, range_out);
+  prerr();
+  printf("%i pages: %i %i %i\n", range_out_len, range_out[0], range_out[1],
+         range_out[2]);
+  cpdf_deleteRange(range_from_array);
   printf("---cpdf_isInRange()\n");
   int range_is_in_range = cpdf_isInRange(range_all, 5);
   prerr();
@@ -141,13 +250,45 @@ int main(int argc, char **argv) {
   printf("---cpdf_pagesFast()\n");
   printf("Pages = %i\n", cpdf_pagesFast("", "cpdflibmanual.pdf"));
   prerr();
+  printf("---cpdf_setPagesFastCache()\n");
+  cpdf_setPagesFastCache(16);
+  cpdf_pagesFast("", "cpdflibmanual.pdf");
+  printf("Pages = %i\n", cpdf_pagesFast("", "cpdflibmanual.pdf"));
+  printf("Hits = %i, misses = %i\n", cpdf_pagesFastCacheHits(),
+         cpdf_pagesFastCacheMisses());
+  cpdf_setPagesFastCache(0);
+  prerr();
   printf("---cpdf_toFile()\n");
   int fout = cpdf_fromFile("cpdflibmanual.pdf", "");
   cpdf_toFile(fout, "testoutputs/01tofile.pdf", false, false);
   prerr();
+  printf("---cpdf_toFileIncremental()\n");
+  int fincremental = cpdf_fromFileLazy("cpdflibmanual.pdf", "");
+  cpdf_setTitle(fincremental, "Incremental");
+  cpdf_toFileIncremental(fincremental, "testoutputs/01tofileincremental.pdf");
+  cpdf_deletePdf(fincremental);
+  int fincremental2 =
+      cpdf_fromFileLazy("testoutputs/01tofileincremental.pdf", "");
+  cpdf_setAuthor(fincremental2, "Incremental");
+  cpdf_toFileIncremental(fincremental2, "testoutputs/01tofileincremental.pdf");
+  cpdf_deletePdf(fincremental2);
+  prerr();
+  printf("---cpdf_toSink()\n");
+  FILE *sinkfile = fopen("testoutputs/01tosink.pdf", "wb");
+  cpdf_toSink(fout, writefile, sinkfile, false, false);
+  fclose(sinkfile);
+  prerr();
   printf("---cpdf_toFileExt()\n");
   cpdf_toFileExt(fout, "testoutputs/01tofileext.pdf", false, true, true, true,
                  true);
+  printf("---cpdf_toSinkExt()\n");
+  int foutsink = cpdf_fromFile("cpdflibmanual.pdf", "");
+  FILE *sinkfileext = fopen("testoutputs/01tosinkext.pdf", "wb");
+  cpdf_toSinkExt(foutsink, writefile, sinkfileext, false, true, true, true,
+                 true);
+  fclose(sinkfileext);
+  cpdf_deletePdf(foutsink);
+  prerr();
   cpdf_deletePdf(f2);
   cpdf_deletePdf(fout);
   prerr();
@@ -158,6 +299,10 @@ int main(int argc, char **argv) {
   printf("---cpdf_isLinearized()\n");
   printf("islinearized:%i\n", cpdf_isLinearized("cpdflibmanual.pdf"));
   prerr();
+  cpdf_toFile(f3, "testoutputs/01linearized.pdf", true, false);
+  printf("islinearized:%i\n",
+         cpdf_isLinearized("testoutputs/01linearized.pdf"));
+  prerr();
   printf("---cpdf_hasObjectStreams()\n");
   printf("hasObjectStreams:%i\n", cpdf_hasObjectStreams(f3));
   prerr();
@@ -203,6 +348,14 @@ int main(int argc, char **argv) {
   printf("---cpdf_encryptionKind()\n");
   printf("encryption kind is %i\n", cpdf_encryptionKind(pdfenc));
   prerr();
+  printf("---cpdf_toFile() linearized, encrypted\n");
+  int pdfenc4 = cpdf_fromFile("testoutputs/01encrypted.pdf", "user");
+  cpdf_toFile(pdfenc4, "testoutputs/01linearizedencrypted.pdf", true, false);
+  cpdf_deletePdf(pdfenc4);
+  int pdfenc5 = cpdf_fromFile("testoutputs/01linearizedencrypted.pdf", "user");
+  printf("isencrypted:%i\n", cpdf_isEncrypted(pdfenc5));
+  cpdf_deletePdf(pdfenc5);
+  prerr();
   printf("---cpdf_decryptPdf()\n");
   cpdf_decryptPdf(pdfenc, "user");
   prerr();
@@ -252,6 +405,44 @@ int main(int argc, char **argv) {
   int selected = cpdf_selectPages(mergepdf, range_select);
   prerr();
   cpdf_toFile(selected, "testoutputs/02selected.pdf", false, false);
+  printf("---cpdf_mergeBegin()\n");
+  FILE *mergesinkfile = fopen("testoutputs/02mergedstreaming.pdf", "wb");
+  int streaming = cpdf_mergeBegin(writefile, mergesinkfile);
+  cpdf_mergeAppendFile(streaming, "cpdflibmanual.pdf", "");
+  cpdf_mergeAppendMemory(streaming, buf, buflen, "");
+  cpdf_mergeEndToSink(streaming);
+  fclose(mergesinkfile);
+  prerr();
+  printf("---cpdf_mergeDeduplicate()\n");
+  FILE *dedupsinkfile = fopen("testoutputs/02mergeddeduplicated.pdf", "wb");
+  int dedup = cpdf_mergeBegin(writefile, dedupsinkfile);
+  cpdf_mergeDeduplicate(dedup, true);
+  cpdf_mergeAppendFile(dedup, "cpdflibmanual.pdf", "");
+  cpdf_mergeAppendFile(dedup, "cpdflibmanual.pdf", "");
+  cpdf_mergeEndToSink(dedup);
+  fclose(dedupsinkfile);
+  prerr();
+  printf("---cpdf_splitToFiles()\n");
+  int splitranges[] = {cpdf_range(1, 3), cpdf_range(4, 6)};
+  cpdf_splitToFiles(mergepdf, splitranges, 2, "testoutputs/02split@N.pdf");
+  prerr();
+  cpdf_splitToFiles(mergepdf, splitranges, 2, "testoutputs/02splitsame.pdf");
+  prerr();
+  cpdf_deleteRange(splitranges[0]);
+  cpdf_deleteRange(splitranges[1]);
+  int splitpair = cpdf_range(1, 2);
+  int splitrepeated = cpdf_rangeAdd(splitpair, 1);
+  cpdf_splitToFiles(mergepdf, &splitrepeated, 1,
+                    "testoutputs/02splitrepeated.pdf");
+  prerr();
+  cpdf_deleteRange(splitpair);
+  cpdf_deleteRange(splitrepeated);
+  printf("---cpdf_splitToFilesBySize()\n");
+  cpdf_splitToFilesBySize(mergepdf, 100000, "testoutputs/02splitsize@N.pdf");
+  prerr();
+  printf("---cpdf_splitToFilesOnBookmarks()\n");
+  cpdf_splitToFilesOnBookmarks(mergepdf, 0, 0, "testoutputs/02splitbookmark@N.pdf");
+  prerr();
   cpdf_deletePdf(mergepdf);
   cpdf_deletePdf(merged);
   cpdf_deletePdf(merged2);
@@ -397,6 +588,15 @@ int main(int argc, char **argv) {
   cpdf_compress(tocompress);
   prerr();
   cpdf_toFile(tocompress, "testoutputs/05compressed.pdf", false, false);
+  printf("---cpdf_setCompressionThreads()\n");
+  int tocompressparallel = cpdf_fromFile("cpdflibmanual.pdf", "");
+  cpdf_setCompressionThreads(4);
+  cpdf_compress(tocompressparallel);
+  cpdf_setCompressionThreads(1);
+  prerr();
+  cpdf_toFile(tocompressparallel, "testoutputs/05compressedparallel.pdf", false,
+              false);
+  cpdf_deletePdf(tocompressparallel);
   printf("---cpdf_decompress()\n");
   cpdf_decompress(tocompress);
   prerr();
@@ -448,6 +648,13 @@ int main(int argc, char **argv) {
   printf("Contains %i bytes of data\n", markslength);
   printf("---cpdf_setBookmarksJSON()\n");
   cpdf_setBookmarksJSON(marksjson, marksdata, markslength);
+  printf("---cpdf_getBookmarksJSON64()\n");
+  size_t markslength64;
+  void *marksdata64 = cpdf_getBookmarksJSON64(marksjson, &markslength64);
+  printf("Contains %zu bytes of data\n", markslength64);
+  printf("---cpdf_setBookmarksJSON64()\n");
+  cpdf_setBookmarksJSON64(marksjson, marksdata64, markslength64);
+  prerr();
   cpdf_toFile(marksjson, "testoutputs/06jsonmarks.pdf", false, false);
   printf("---cpdf_tableOfContents()\n");
   int tocfile = cpdf_fromFile("cpdflibmanual.pdf", "");
@@ -639,11 +846,19 @@ int main(int argc, char **argv) {
   printf("---cpdf_annotationsJSON()\n");
   void *data = cpdf_annotationsJSON(annot, &annotlength);
   printf("Contains %i bytes of data\n", annotlength);
+  printf("---cpdf_annotationsJSON64()\n");
+  size_t annotlength64;
+  void *data64 = cpdf_annotationsJSON64(annot, &annotlength64);
+  printf("Contains %zu bytes of data\n", annotlength64);
   printf("---cpdf_removeAnnotations()\n");
   int r_annot = cpdf_range(1, 1);
   cpdf_removeAnnotations(annot, r_annot);
   printf("---cpdf_setAnnotationsJSON()\n");
   cpdf_setAnnotationsJSON(annot, data, annotlength);
+  printf("---cpdf_setAnnotationsJSON64()\n");
+  cpdf_removeAnnotations(annot, r_annot);
+  cpdf_setAnnotationsJSON64(annot, data64, annotlength64);
+  prerr();
   cpdf_deletePdf(annot);
   cpdf_deleteRange(r_annot);
 
@@ -711,6 +926,10 @@ int main(int argc, char **argv) {
   int pilength;
   void *pidata = cpdf_pageInfoJSON(pijson, &pilength);
   printf("Contains %i bytes of data\n", pilength);
+  printf("---cpdf_pageInfoJSON64()\n");
+  size_t pilength64;
+  void *pidata64 = cpdf_pageInfoJSON64(pijson, &pilength64);
+  printf("Contains %zu bytes of data\n", pilength64);
   printf("---cpdf_setTitle()\n");
   cpdf_setTitle(info, "title");
   prerr();
@@ -804,6 +1023,16 @@ int main(int argc, char **argv) {
   cpdf_getTrimBox(info, 1, &minx, &maxx, &miny, &maxy);
   prerr();
   printf("Trim: %f %f %f %f\n", minx, maxx, miny, maxy);
+  printf("---cpdf_getPageGeometryBatch()\n");
+  struct cpdf_pageGeometry geometry[1];
+  int geometries = cpdf_getPageGeometryBatch(info, cpdf_range(1, 1), geometry);
+  prerr();
+  for (int x = 0; x < geometries; x++)
+    printf("Page %i: media %f %f %f %f rotation %i annots %i\n",
+           geometry[x].pagenumber, geometry[x].mediabox.minx,
+           geometry[x].mediabox.maxx, geometry[x].mediabox.miny,
+           geometry[x].mediabox.maxy, geometry[x].rotation,
+           geometry[x].annotations);
   printf("---cpdf_setMediaBox()\n");
   cpdf_setMediabox(info, r_info, 100, 500, 150, 550);
   prerr();
@@ -903,11 +1132,18 @@ int main(int argc, char **argv) {
   cpdf_setMetadataFromByteArray(info, "BYTEARRAY", 9);
   prerr();
   cpdf_toFile(info, "testoutputs/11metadata2.pdf", false, false);
+  printf("---cpdf_setMetadataFromByteArray64()\n");
+  cpdf_setMetadataFromByteArray64(info, "BYTEARRAY", 9);
+  prerr();
   int metadata_length;
   printf("---cpdf_getMetadata()\n");
   void *metadata;
   metadata = cpdf_getMetadata(info, &metadata_length);
   prerr();
+  printf("---cpdf_getMetadata64()\n");
+  size_t metadata_length64;
+  void *metadata64 = cpdf_getMetadata64(info, &metadata_length64);
+  prerr();
   printf("---cpdf_removeMetadata()\n");
   cpdf_removeMetadata(info);
   prerr();
@@ -950,6 +1186,10 @@ int main(int argc, char **argv) {
   int complength;
   void *compdata = cpdf_compositionJSON(1000000, compjson, &complength);
   printf("Contains %i bytes of data\n", complength);
+  printf("---cpdf_compositionJSON64()\n");
+  size_t complength64;
+  void *compdata64 = cpdf_compositionJSON64(1000000, compjson, &complength64);
+  printf("Contains %zu bytes of data\n", complength64);
   cpdf_deletePdf(compjson);
   cpdf_deletePdf(info);
   cpdf_deletePdf(pijson);
@@ -970,6 +1210,13 @@ int main(int argc, char **argv) {
   printf("---cpdf_attachFileToPageFromMemory()\n");
   cpdf_attachFileToPageFromMemory((void *)0, 0, "metadata.txt", attachments, 1);
   prerr();
+  printf("---cpdf_attachFileFromMemory64()\n");
+  cpdf_attachFileFromMemory64((void *)0, 0, "metadata.txt", attachments);
+  prerr();
+  printf("---cpdf_attachFileToPageFromMemory64()\n");
+  cpdf_attachFileToPageFromMemory64((void *)0, 0, "metadata.txt", attachments,
+                                    1);
+  prerr();
   cpdf_toFile(attachments, "testoutputs/12with_attachments.pdf", false, false);
   printf("---cpdf: get attachments\n");
   cpdf_startGetAttachments(attachments);
@@ -983,6 +1230,9 @@ int main(int argc, char **argv) {
     int length;
     cpdf_getAttachmentData(x, &length);
     printf("Contains %i bytes of data\n", length);
+    size_t length64;
+    cpdf_getAttachmentData64(x, &length64);
+    printf("Contains %zu bytes of data\n", length64);
   };
   prerr();
   cpdf_endGetAttachments();
@@ -1042,6 +1292,14 @@ int main(int argc, char **argv) {
   printf("---cpdf_imagesJSON()\n");
   void *irdata2 = cpdf_imagesJSON(images, &irlength);
   printf("Contains %i bytes of data\n", irlength);
+  printf("---cpdf_imageResolutionJSON64()\n");
+  size_t irlength64;
+  void *irdata64 = cpdf_imageResolutionJSON64(images, &irlength64, 300.);
+  printf("Contains %zu bytes of data\n", irlength64);
+  prerr();
+  printf("---cpdf_imagesJSON64()\n");
+  void *irdata264 = cpdf_imagesJSON64(images, &irlength64);
+  printf("Contains %zu bytes of data\n", irlength64);
   cpdf_deletePdf(images);
   cpdf_deletePdf(images2);
 
@@ -1067,6 +1325,10 @@ int main(int argc, char **argv) {
   int fontslength;
   void *fontsdata = cpdf_fontsJSON(fontsjson, &fontslength);
   printf("Contains %i bytes of data\n", fontslength);
+  printf("---cpdf_fontsJSON64()\n");
+  size_t fontslength64;
+  void *fontsdata64 = cpdf_fontsJSON64(fontsjson, &fontslength64);
+  printf("Contains %zu bytes of data\n", fontslength64);
   printf("---cpdf_removeFonts()\n");
   int fontrange = cpdf_all(fonts);
   cpdf_removeFonts(fonts);
@@ -1103,6 +1365,13 @@ int main(int argc, char **argv) {
   //int jfrommem = cpdf_fromJSONMemory(jbuf, jbuflen);
   //cpdf_toFile(jfrommem, "testoutputs/15fromJSONMemory.pdf", false, false);
   //prerr();
+  //size_t jbuflen64;
+  //printf("---cpdf_outputJSONMemory64()\n");
+  //void *jbuf64 = cpdf_outputJSONMemory64(jsonpdf, false, false, false,
+  //                                       &jbuflen64);
+  //printf("---cpdf_fromJSONMemory64()\n");
+  //int jfrommem64 = cpdf_fromJSONMemory64(jbuf64, jbuflen64);
+  //prerr();
   //cpdf_deletePdf(json);
   //cpdf_deletePdf(jsonpdf);
   //cpdf_deletePdf(jfrommem);
@@ -1146,6 +1415,11 @@ int main(int argc, char **argv) {
   char *str = "Hello, World!";
   int ttpdf2 = cpdf_textToPDFMemory(500.0, 600.0, "A", 8.0, (void *)str, 13);
   cpdf_toFile(ttpdf2, "testoutputs/17ttpdf2.pdf", false, false);
+  printf("---cpdf_textToPDFMemory64()\n");
+  int ttpdf264 =
+      cpdf_textToPDFMemory64(500.0, 600.0, "A", 8.0, (void *)str, 13);
+  prerr();
+  cpdf_deletePdf(ttpdf264);
   printf("---cpdf_textToPDFPaper()\n");
   int ttpdfpaper =
       cpdf_textToPDFPaper(cpdf_a4portrait, "A", 10.0, "cpdflibtest.c");
@@ -1154,6 +1428,11 @@ int main(int argc, char **argv) {
   int ttpdfpaper2 =
       cpdf_textToPDFPaperMemory(cpdf_a4portrait, "A", 10.0, (void *)str, 13);
   cpdf_toFile(ttpdfpaper2, "testoutputs/17ttpdfpaper2.pdf", false, false);
+  printf("---cpdf_textToPDFPaperMemory64()\n");
+  int ttpdfpaper264 =
+      cpdf_textToPDFPaperMemory64(cpdf_a4portrait, "A", 10.0, (void *)str, 13);
+  prerr();
+  cpdf_deletePdf(ttpdfpaper264);
   printf("---cpdf_fromPNG()\n");
   int png = cpdf_fromPNG("testinputs/png.png");
   cpdf_toFile(png, "testoutputs/17png.pdf", false, false);
@@ -1163,6 +1442,10 @@ int main(int argc, char **argv) {
   void *pngfile = mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);
   int png2 = cpdf_fromPNGMemory(pngfile, len);
   cpdf_toFile(png2, "testoutputs/17png2.pdf", false, false);
+  printf("---cpdf_fromPNGMemory64()\n");
+  int png264 = cpdf_fromPNGMemory64(pngfile, len);
+  prerr();
+  cpdf_deletePdf(png264);
   printf("---cpdf_fromJPEG()\n");
   int jpg = cpdf_fromJPEG("testinputs/jpg.jpg");
   cpdf_toFile(jpg, "testoutputs/17jpg.pdf", false, false);
@@ -1172,6 +1455,10 @@ int main(int argc, char **argv) {
   void *jpgfile = mmap(0, len2, PROT_READ, MAP_PRIVATE, fd2, 0);
   int jpg2 = cpdf_fromJPEGMemory(jpgfile, len2);
   cpdf_toFile(jpg2, "testoutputs/17jpg2.pdf", false, false);
+  printf("---cpdf_fromJPEGMemory64()\n");
+  int jpg264 = cpdf_fromJPEGMemory64(jpgfile, len2);
+  prerr();
+  cpdf_deletePdf(jpg264);
   cpdf_deletePdf(ttpdf);
   cpdf_deletePdf(ttpdfpaper);
   cpdf_deletePdf(ttpdf2);
@@ -1419,6 +1706,9 @@ int main(int argc, char **argv) {
   int len3 = lseek(fd3, 0, SEEK_END);
   void *jpgfile2 = mmap(0, len3, PROT_READ, MAP_PRIVATE, fd3, 0);
   cpdf_drawJPEGMemory("A2", jpgfile2, len3);
+  printf("---cpdf_drawJPEGMemory64()\n");
+  cpdf_drawJPEGMemory64("A3", jpgfile2, len3);
+  prerr();
   printf("---cpdf_drawPNG()\n");
   cpdf_drawPNG("B", "testinputs/png.png");
   prerr();
@@ -1427,6 +1717,9 @@ int main(int argc, char **argv) {
   int len4 = lseek(fd4, 0, SEEK_END);
   void *pngfile2 = mmap(0, len4, PROT_READ, MAP_PRIVATE, fd4, 0);
   cpdf_drawPNGMemory("B2", pngfile2, len4);
+  printf("---cpdf_drawPNGMemory64()\n");
+  cpdf_drawPNGMemory64("B3", pngfile2, len4);
+  prerr();
   printf("---cpdf_drawImage()\n");
   cpdf_drawImage("A");
   cpdf_drawMScale(0, 0, 0.95, 0.95);
@@ -1595,6 +1888,11 @@ int main(int argc, char **argv) {
   void *geddata = cpdf_getDictEntries(misc16, "/Producer", &gedlength);
   printf("length of entries data = %i\n", gedlength);
   prerr();
+  printf("---cpdf_getDictEntries64()\n");
+  size_t gedlength64;
+  void *geddata64 = cpdf_getDictEntries64(misc16, "/Producer", &gedlength64);
+  printf("length of entries data = %zu\n", gedlength64);
+  prerr();
   printf("---cpdf_removeClipping()\n");
   cpdf_removeClipping(misc12, misc_r);
   prerr();
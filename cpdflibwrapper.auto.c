@@ -1,170 +1,224 @@
 #include <caml/alloc.h>
 #include <caml/bigarray.h>
 #include <caml/callback.h>
+#include <caml/custom.h>
+#include <caml/fail.h>
 #include <caml/memory.h>
+#include <caml/threads.h>
+#include <zlib.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Set var to the OCaml value registered under the given name. Looking up a
+ * name hashes it, so the result is kept in a static variable at each use,
+ * and the lookup made only the first time. The value itself may move, but
+ * the pointer to it does not.
+ */
+#define NAMED_VALUE(var, name)                                               \
+  static const value *var##_named = NULL;                                    \
+  if (var##_named == NULL) var##_named = caml_named_value(name);             \
+  var = *var##_named
+
+/*
+ * Used in place of CAMLparam0 and CAMLreturn in each function in the
+ * interface, so that in thread-safe mode the library is locked for the
+ * duration of the call. The lock is released only after the local roots are
+ * dropped.
+ */
+#define CPDFparam0()                                                         \
+  enterLibrary();                                                            \
+  CAMLparam0()
+
+#define CPDFreturn0                                                          \
+  do {                                                                       \
+    CAMLdrop;                                                                \
+    leaveLibrary();                                                          \
+    return;                                                                  \
+  } while (0)
+
+#define CPDFreturnT(type, result)                                            \
+  do {                                                                       \
+    type cpdf__result = (result);                                            \
+    CAMLdrop;                                                                \
+    leaveLibrary();                                                          \
+    return cpdf__result;                                                     \
+  } while (0)
 
 
 /* __AUTODEF unit->unit
 void cpdf_~() {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn_v, unit_v);
-  fn_v = *caml_named_value("~");
+  NAMED_VALUE(fn_v, "~");
   unit_v = caml_callback(fn_v, Val_unit);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF string->string->int
 int cpdf_~(char *one, char *two) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal4(fn_v, one_v, two_v, result_v);
-  fn_v = *caml_named_value("~");
+  NAMED_VALUE(fn_v, "~");
   one_v = caml_copy_string(one);
   two_v = caml_copy_string(two);
   result_v = caml_callback2(fn_v, one_v, two_v);
   updateLastError();
-  CAMLreturnT(int, Int_val(result_v));
+  CPDFreturnT(int, Int_val(result_v));
 }
 */
 
 /* __AUTODEF float->float
 double cpdf_~(double f) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal3(fn, in, out);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   in = caml_copy_double(f);
   out = caml_callback(fn, in);
   updateLastError();
-  CAMLreturnT(double, Double_val(out));
+  CPDFreturnT(double, Double_val(out));
 }
 */
 
 /* __AUTODEF int->int
 int cpdf_~(int pdf) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal3(fn, in_v, out_v);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   in_v = Val_int(pdf);
   out_v = caml_callback(fn, in_v);
   updateLastError();
-  CAMLreturnT(int, Int_val(out_v));
+  CPDFreturnT(int, Int_val(out_v));
 }
 */
 
 /* __AUTODEF int->int->int
 int cpdf_~(int a, int b) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal4(fn, out_v, av, bv);
   av = Val_int(a);
   bv = Val_int(b);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   out_v = caml_callback2(fn, av, bv);
   updateLastError();
-  CAMLreturnT(int, Int_val(out_v));
+  CPDFreturnT(int, Int_val(out_v));
 }
 */
 
 /* __AUTODEF int->unit
 void cpdf_~(int pdf) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal3(fn, int_in, unit_out);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   int_in = Val_int(pdf);
   unit_out = caml_callback(fn, int_in);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->string->unit
 void cpdf_~(int pdf, char *s) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal4(unit, fn, pdf_v, s_v);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   pdf_v = Val_int(pdf);
   s_v = caml_copy_string(s);
   unit = caml_callback2(fn, pdf_v, s_v);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->int->unit
 void cpdf_~(int o, int n) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal4(fn, o_v, n_v, unit_out);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   o_v = Val_int(o);
   n_v = Val_int(n);
   unit_out = caml_callback2(fn, o_v, n_v);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF float->unit
 void cpdf_~(double o) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal3(fn, o_v, unit_out);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   o_v = caml_copy_double(o);
   unit_out = caml_callback(fn, o_v);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF float->float->unit
 void cpdf_~(double o, double n) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal4(fn, o_v, n_v, unit_out);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   o_v = caml_copy_double(o);
   n_v = caml_copy_double(n);
   unit_out = caml_callback2(fn, o_v, n_v);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF float->float->float->unit
 void cpdf_~(double o, double n, double m) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal5(fn, o_v, n_v, m_v, unit_out);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   o_v = caml_copy_double(o);
   n_v = caml_copy_double(n);
   m_v = caml_copy_double(m);
   unit_out = caml_callback3(fn, o_v, n_v, m_v);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF float->float->float->float->unit
 void cpdf_~(double o, double n, double m, double p) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn, unit_out);
   CAMLlocalN(args, 4);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   args[0] = caml_copy_double(o);
   args[1] = caml_copy_double(n);
   args[2] = caml_copy_double(m);
   args[3] = caml_copy_double(p);
   unit_out = caml_callbackN(fn, 4, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF float->float->float->float->float->float->unit
 void cpdf_~(double o, double n, double m, double p, double q, double r) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn, unit_out);
   CAMLlocalN(args, 6);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   args[0] = caml_copy_double(o);
   args[1] = caml_copy_double(n);
   args[2] = caml_copy_double(m);
@@ -173,142 +227,142 @@ void cpdf_~(double o, double n, double m, double p, double q, double r) {
   args[5] = caml_copy_double(r);
   unit_out = caml_callbackN(fn, 6, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF unit->int
 int cpdf_~(void) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal3(f_v, unit_v, int_v);
-  f_v = *caml_named_value("~");
+  NAMED_VALUE(f_v, "~");
   unit_v = Val_unit;
   int_v = caml_callback(f_v, unit_v);
   updateLastError();
-  CAMLreturnT(int, Int_val(int_v));
+  CPDFreturnT(int, Int_val(int_v));
 }
 */
 
 /* __AUTODEF int->string
 char *cpdf_~(int key) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal3(f, key_v, out_v);
-  f = *caml_named_value("~");
+  NAMED_VALUE(f, "~");
   key_v = Val_int(key);
   out_v = caml_callback(f, key_v);
   updateLastError();
-  CAMLreturnT(char *, (char *)String_val(out_v));
+  CPDFreturnT(char *, returnString(out_v));
 }
 */
 
 /* __AUTODEF string->int
 int cpdf_~(char *str) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal3(fn, instr, out);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   instr = caml_copy_string(str);
   out = caml_callback(fn, instr);
   updateLastError();
-  CAMLreturnT(int, Int_val(out));
+  CPDFreturnT(int, Int_val(out));
 }
 */
 
 /* __AUTODEF string->unit
 void cpdf_~(char *str) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal3(fn, instr, out);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   instr = caml_copy_string(str);
   out = caml_callback(fn, instr);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF string->string->unit
 void cpdf_~(char *str, char* str2) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal4(fn, instr, instr2, out);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   instr = caml_copy_string(str);
   instr2 = caml_copy_string(str2);
   out = caml_callback2(fn, instr, instr2);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->string->int
 int cpdf_~(int i, char *str) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal4(fn, ini, instr, out);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   ini = Val_int(i);
   instr = caml_copy_string(str);
   out = caml_callback2(fn, ini, instr);
   updateLastError();
-  CAMLreturnT(int, Int_val(out));
+  CPDFreturnT(int, Int_val(out));
 }
 */
 
 /* __AUTODEF int->int->string
 char *cpdf_~(int a, int b) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal4(fn, a_v, b_v, out);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   a_v = Val_int(a);
   b_v = Val_int(b);
   out = caml_callback2(fn, a_v, b_v);
   updateLastError();
-  CAMLreturnT(char *, (char *)String_val(out));
+  CPDFreturnT(char *, returnString(out));
 }
 */
 
 /* __AUTODEF int->int->int->unit
 void cpdf_~(int pdf, int range, int angle) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal5(unit, fn, pdf_v, range_v, angle_v);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   pdf_v = Val_int(pdf);
   range_v = Val_int(range);
   angle_v = Val_int(angle);
   unit = caml_callback3(fn, pdf_v, range_v, angle_v);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->float
 double cpdf_~(int serial) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal3(fn, serial_v, out_v);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   serial_v = Val_int(serial);
   out_v = caml_callback(fn, serial_v);
   updateLastError();
-  CAMLreturnT(int, Double_val(out_v));
+  CPDFreturnT(int, Double_val(out_v));
 }
 */
 
 /* __AUTODEF int->int->float->float->unit
 void cpdf_~(int pdf, int range, double sx, double sy) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn, unit);
   CAMLlocalN(args, 4);
   args[0] = Val_int(pdf);
   args[1] = Val_int(range);
   args[2] = caml_copy_double(sx);
   args[3] = caml_copy_double(sy);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   unit = caml_callbackN(fn, 4, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->int->float->float->float->unit
 void cpdf_~(int pdf, int range, double w, double h, double scale) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocalN(args, 5);
   CAMLlocal2(fn, unit);
   args[0] = Val_int(pdf);
@@ -316,32 +370,32 @@ void cpdf_~(int pdf, int range, double w, double h, double scale) {
   args[2] = caml_copy_double(w);
   args[3] = caml_copy_double(h);
   args[4] = caml_copy_double(scale);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   unit = caml_callbackN(fn, 5, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->int->int->float->unit
 void cpdf_~(int pdf, int range, int papersize, double scale) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocalN(args, 4);
   CAMLlocal2(unit, fn);
   args[0] = Val_int(pdf);
   args[1] = Val_int(range);
   args[2] = Val_int(papersize);
   args[3] = caml_copy_double(scale);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   unit = caml_callbackN(fn, 4, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->int->float->float->float->float->unit
 void cpdf_~(int pdf, int range, double x, double y, double w, double h) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocalN(args, 6);
   CAMLlocal2(unit, fn);
   args[0] = Val_int(pdf);
@@ -350,31 +404,47 @@ void cpdf_~(int pdf, int range, double x, double y, double w, double h) {
   args[3] = caml_copy_double(y);
   args[4] = caml_copy_double(w);
   args[5] = caml_copy_double(h);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   unit = caml_callbackN(fn, 6, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->int->string->unit
 void cpdf_~(int pdf, int range, char *box) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal5(unit, fn, pdf_v, range_v, box_v);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   pdf_v = Val_int(pdf);
   range_v = Val_int(range);
   box_v = caml_copy_string(box);
   unit = caml_callback3(fn, pdf_v, range_v, box_v);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
+}
+*/
+
+/* __AUTODEF int->int->int->string->unit
+void cpdf_~(int pdf, int a, int b, char *str) {
+  CPDFparam0();
+  CAMLlocal2(fn_v, out_v);
+  NAMED_VALUE(fn_v, "~");
+  CAMLlocalN(args, 4);
+  args[0] = Val_int(pdf);
+  args[1] = Val_int(a);
+  args[2] = Val_int(b);
+  args[3] = caml_copy_string(str);
+  out_v = caml_callbackN(fn_v, 4, args);
+  updateLastError();
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->string->float->string->int->unit
 void cpdf_tableOfContents(int pdf, char* font, double fontsize, char *title,
                           int bookmark) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocalN(args, 5);
   args[0] = Val_int(pdf);
   args[1] = caml_copy_string(font);
@@ -382,63 +452,63 @@ void cpdf_tableOfContents(int pdf, char* font, double fontsize, char *title,
   args[3] = caml_copy_string(title);
   args[4] = Val_int(bookmark);
   CAMLlocal2(fn_v, out_v);
-  fn_v = *caml_named_value("tableOfContents");
+  NAMED_VALUE(fn_v, "tableOfContents");
   out_v = caml_callbackN(fn_v, 5, args);
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF string->int->int->int->unit
 void cpdf_addContent(char *s, int before, int pdf, int range) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn, out);
   CAMLlocalN(args, 4);
   args[0] = caml_copy_string(s);
   args[1] = Val_int(before);
   args[2] = Val_int(pdf);
   args[3] = Val_int(range);
-  fn = *caml_named_value("addContent");
+  NAMED_VALUE(fn, "addContent");
   out = caml_callbackN(fn, 4, args);
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->int->int->string
 char *cpdf_~(int pdf, int range, int stamp_pdf) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal5(pdf_v, range_v, stamp_pdf_v, fn, name_v);
   pdf_v = Val_int(pdf);
   range_v = Val_int(range);
   stamp_pdf_v = Val_int(stamp_pdf);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   name_v = caml_callback3(fn, pdf_v, range_v, stamp_pdf_v);
   updateLastError();
-  CAMLreturnT(char *, (char *)String_val(name_v));
+  CPDFreturnT(char *, returnString(name_v));
 }
 */
 
 /* __AUTODEF int->int->string->int
 int cpdf_~(int pdf, int pagenumber, char *boxname) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal4(fn, pdf_v, pagenumber_v, boxname_v);
   CAMLlocal1(out_v);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   pdf_v = Val_int(pdf);
   pagenumber_v = Val_int(pagenumber);
   boxname_v = caml_copy_string(boxname);
   out_v = caml_callback3(fn, pdf_v, pagenumber_v, boxname_v);
   updateLastError();
-  CAMLreturnT(int, Int_val(out_v));
+  CPDFreturnT(int, Int_val(out_v));
 }
 */
 
 /* __AUTODEF int->int->float*->float*->float*->float*->unit
 void cpdf_~(int pdf, int pagenumber, double *minx, double *maxx,
                       double *miny, double *maxy) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal5(fn, pdf_v, pagenumber_v, tuple_v, minx_v);
   CAMLlocal3(maxx_v, miny_v, maxy_v);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   pdf_v = Val_int(pdf);
   pagenumber_v = Val_int(pagenumber);
   tuple_v = caml_callback2(fn, pdf_v, pagenumber_v);
@@ -451,14 +521,14 @@ void cpdf_~(int pdf, int pagenumber, double *minx, double *maxx,
   *maxx = Double_val(maxx_v);
   *miny = Double_val(miny_v);
   *maxy = Double_val(maxy_v);
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->int->float->float->float->float->unit
 void cpdf_~(int pdf, int range, double minx, double maxx, double miny,
                       double maxy) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocalN(args, 6);
   CAMLlocal2(unit, fn);
   args[0] = Val_int(pdf);
@@ -467,19 +537,19 @@ void cpdf_~(int pdf, int range, double minx, double maxx, double miny,
   args[3] = caml_copy_double(maxx);
   args[4] = caml_copy_double(miny);
   args[5] = caml_copy_double(maxy);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   unit = caml_callbackN(fn, 6, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->int->string->int->int->int->unit
 void cpdf_~(int pdf, enum cpdf_pageLabelStyle style, char *prefix,
                         int offset, int range, int progress) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn, out_v);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   CAMLlocalN(args, 6);
   args[0] = Val_int(pdf);
   args[1] = Val_int(style);
@@ -489,56 +559,56 @@ void cpdf_~(int pdf, enum cpdf_pageLabelStyle style, char *prefix,
   args[5] = Val_int(progress);
   out_v = caml_callbackN(fn, 6, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF string->int->unit
 void cpdf_~(char *filename, int pdf) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal4(unit, fn, filename_v, pdf_v);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   filename_v = caml_copy_string(filename);
   pdf_v = Val_int(pdf);
   unit = caml_callback2(fn, filename_v, pdf_v);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF string->int->int->unit
 void cpdf_~(char *filename, int pdf, int pagenumber) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal5(unit, fn, filename_v, pdf_v, pagenumber_v);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   filename_v = caml_copy_string(filename);
   pdf_v = Val_int(pdf);
   pagenumber_v = Val_int(pagenumber);
   unit = caml_callback3(fn, filename_v, pdf_v, pagenumber_v);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->float->int
 int cpdf_~(int pdf, double res) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal4(fn, pdf_v, out_v, res_v);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   pdf_v = Val_int(pdf);
   res_v = caml_copy_double(res);
   out_v = caml_callback2(fn, pdf_v, res_v);
   updateLastError();
-  CAMLreturnT(int, Int_val(out_v));
+  CPDFreturnT(int, Int_val(out_v));
 }
 */
 
 /* __AUTODEF int->int->int->int->string->unit
 void cpdf_~(int from_pdf, int to_pdf, int range, int pagenumber,
                    char *fontname) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn_v, out_v);
-  fn_v = *caml_named_value("~");
+  NAMED_VALUE(fn_v, "~");
   CAMLlocalN(args, 5);
   args[0] = Val_int(from_pdf);
   args[1] = Val_int(to_pdf);
@@ -547,15 +617,15 @@ void cpdf_~(int from_pdf, int to_pdf, int range, int pagenumber,
   args[4] = caml_copy_string(fontname);
   out_v = caml_callbackN(fn_v, 5, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->int->int->int->int->int->int->unit
 void cpdf_~(int a, int b, int c, int d, int e, int f, int g) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn_v, out_v);
-  fn_v = *caml_named_value("~");
+  NAMED_VALUE(fn_v, "~");
   CAMLlocalN(args, 7);
   args[0] = Val_int(a);
   args[1] = Val_int(b);
@@ -566,41 +636,41 @@ void cpdf_~(int a, int b, int c, int d, int e, int f, int g) {
   args[6] = Val_int(g);
   out_v = caml_callbackN(fn_v, 7, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->string->string->unit
 void cpdf_~(int pdf, char *f, char *t) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal5(pdf_v, unit_v, fn, f_v, t_v);
   pdf_v = Val_int(pdf);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   f_v = caml_copy_string(f);
   t_v = caml_copy_string(t);
   unit_v = caml_callback3(fn, pdf_v, f_v, t_v);
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF float->float->int->int
 int cpdf_~(double width, double height, int pages) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal5(fn, width_v, height_v, pages_v, out);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   width_v = caml_copy_double(width);
   height_v = caml_copy_double(height);
   pages_v = Val_int(pages);
   out = caml_callback3(fn, width_v, height_v, pages_v);
   updateLastError();
-  CAMLreturnT(int, Int_val(out));
+  CPDFreturnT(int, Int_val(out));
 }
 */
 
 /* __AUTODEF float->float->string->float->string->int
 int cpdf_~(double w, double h, char* font, double fontsize,
                    char *filename) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn_v, out_v);
   CAMLlocalN(args, 5);
   args[0] = caml_copy_double(w);
@@ -608,159 +678,163 @@ int cpdf_~(double w, double h, char* font, double fontsize,
   args[2] = caml_copy_string(font);
   args[3] = caml_copy_double(fontsize);
   args[4] = caml_copy_string(filename);
-  fn_v = *caml_named_value("~");
+  NAMED_VALUE(fn_v, "~");
   out_v = caml_callbackN(fn_v, 5, args);
-  CAMLreturnT(int, Int_val(out_v));
+  CPDFreturnT(int, Int_val(out_v));
 }
 */
 
 /* __AUTODEF int->string->float->string->int
 int cpdf_~(int papersize, char* font, double fontsize,
                         char *filename) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn_v, out_v);
   CAMLlocalN(args, 4);
-  fn_v = *caml_named_value("~");
+  NAMED_VALUE(fn_v, "~");
   args[0] = Val_int(papersize);
   args[1] = caml_copy_string(font);
   args[2] = caml_copy_double(fontsize);
   args[3] = caml_copy_string(filename);
   out_v = caml_callbackN(fn_v, 4, args);
-  CAMLreturnT(int, Int_val(out_v));
+  CPDFreturnT(int, Int_val(out_v));
 }
 */
 
 /* __AUTODEF int->int->float->unit
 void cpdf_~(int pdf, int range, double minwidth) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal5(unit, fn, pdf_v, range_v, minwidth_v);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   pdf_v = Val_int(pdf);
   range_v = Val_int(range);
   minwidth_v = caml_copy_double(minwidth);
   unit = caml_callback3(fn, pdf_v, range_v, minwidth_v);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF int->string->string->string->unit
 void cpdf_~(int pdf, char *key, char *newvalue,
                                  char *searchterm) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn_v, out_v);
   CAMLlocalN(args, 4);
-  fn_v = *caml_named_value("~");
+  NAMED_VALUE(fn_v, "~");
   args[0] = Val_int(pdf);
   args[1] = caml_copy_string(key);
   args[2] = caml_copy_string(newvalue);
   args[3] = caml_copy_string(searchterm);
   out_v = caml_callbackN(fn_v, 4, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 */
 
 /* __AUTODEF void*->int->string->int
-int cpdf_~(void *data, int len, char *userpw) {
-  CAMLparam0();
+int cpdf_~64(void *data, size_t len, char *userpw) {
+  CPDFparam0();
   CAMLlocal4(pdf_v, bytestream, fn, userpw_v);
-  bytestream =
-      caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data, len);
-  fn = *caml_named_value("~");
+  bytestream = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data,
+                                  (intnat)len);
+  NAMED_VALUE(fn, "~");
   userpw_v = caml_copy_string(userpw);
   pdf_v = caml_callback2(fn, bytestream, userpw_v);
   updateLastError();
-  CAMLreturnT(int, Int_val(pdf_v));
+  CPDFreturnT(int, Int_val(pdf_v));
+}
+int cpdf_~(void *data, int len, char *userpw) {
+  return cpdf_~64(data, len, userpw);
 }
 */
 
 /* __AUTODEF int->int*->void*
+void *cpdf_~64(int pdf, size_t *retlen) {
+  CPDFparam0();
+  CAMLlocal3(fn, bytestream, pdf_v);
+  NAMED_VALUE(fn, "~");
+  pdf_v = Val_int(pdf);
+  bytestream = caml_callback(fn, pdf_v);
+  updateLastError();
+  void *memory = returnBytestream(bytestream, retlen, 1, "~");
+  CPDFreturnT(void *, memory);
+}
 void *cpdf_~(int pdf, int *retlen) {
-  CAMLparam0();
+  size_t size;
+  void *memory = cpdf_~64(pdf, &size);
+  return narrowLength(memory, size, retlen, "~");
+}
+*/
+
+/* __AUTODEF int->int*->copied
+void *cpdf_~64(int pdf, size_t *retlen) {
+  CPDFparam0();
   CAMLlocal3(fn, bytestream, pdf_v);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   pdf_v = Val_int(pdf);
   bytestream = caml_callback(fn, pdf_v);
   updateLastError();
-  char *memory = NULL;
-  int size = Caml_ba_array_val(bytestream)->dim[0];
-  memory = calloc(size, sizeof(char));
-  if (memory == NULL && size > 0) fprintf(stderr, "~: failed");
-  if (size > 0) {
-    int x;
-    char *indata = Caml_ba_data_val(bytestream);
-    for (x = 0; x < size; x++) {
-      memory[x] = indata[x];
-    };
-  }
-  *retlen = size;
-  CAMLreturnT(void *, memory);
+  void *memory = returnBytestream(bytestream, retlen, 0, "~");
+  CPDFreturnT(void *, memory);
+}
+void *cpdf_~(int pdf, int *retlen) {
+  size_t size;
+  void *memory = cpdf_~64(pdf, &size);
+  return narrowLength(memory, size, retlen, "~");
 }
 */
 
 /* __AUTODEF int->int*->float->void*
-void *cpdf_~(int pdf, int *retlen, double f) {
-  CAMLparam0();
+void *cpdf_~64(int pdf, size_t *retlen, double f) {
+  CPDFparam0();
   CAMLlocal4(fn, bytestream, pdf_v, f_v);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   pdf_v = Val_int(pdf);
   f_v = caml_copy_double(f);
   bytestream = caml_callback2(fn, pdf_v, f_v);
   updateLastError();
-  char *memory = NULL;
-  int size = Caml_ba_array_val(bytestream)->dim[0];
-  memory = calloc(size, sizeof(char));
-  if (memory == NULL && size > 0) fprintf(stderr, "~: failed");
-  if (size > 0) {
-    int x;
-    char *indata = Caml_ba_data_val(bytestream);
-    for (x = 0; x < size; x++) {
-      memory[x] = indata[x];
-    };
-  }
-  *retlen = size;
-  CAMLreturnT(void *, memory);
+  void *memory = returnBytestream(bytestream, retlen, 1, "~");
+  CPDFreturnT(void *, memory);
+}
+void *cpdf_~(int pdf, int *retlen, double f) {
+  size_t size;
+  void *memory = cpdf_~64(pdf, &size, f);
+  return narrowLength(memory, size, retlen, "~");
 }
 */
 
 /* __AUTODEF int->int->int*->void*
-void *cpdf_~(int filesize, int pdf, int *retlen) {
-  CAMLparam0();
+void *cpdf_~64(size_t filesize, int pdf, size_t *retlen) {
+  CPDFparam0();
   CAMLlocal4(fn, filesize_v, bytestream, pdf_v);
-  fn = *caml_named_value("~");
+  NAMED_VALUE(fn, "~");
   pdf_v = Val_int(pdf);
-  filesize_v = Val_int(filesize);
+  filesize_v = Val_long(filesize);
   bytestream = caml_callback2(fn, filesize_v, pdf_v);
   updateLastError();
-  char *memory = NULL;
-  int size = Caml_ba_array_val(bytestream)->dim[0];
-  memory = calloc(size, sizeof(char));
-  if (memory == NULL && size > 0) fprintf(stderr, "~: failed");
-  if (size > 0) {
-    int x;
-    char *indata = Caml_ba_data_val(bytestream);
-    for (x = 0; x < size; x++) {
-      memory[x] = indata[x];
-    };
-  }
-  *retlen = size;
-  CAMLreturnT(void *, memory);
+  void *memory = returnBytestream(bytestream, retlen, 1, "~");
+  CPDFreturnT(void *, memory);
+}
+void *cpdf_~(int filesize, int pdf, int *retlen) {
+  size_t size;
+  void *memory = cpdf_~64(filesize, pdf, &size);
+  return narrowLength(memory, size, retlen, "~");
 }
 */
 
 /* __AUTODEF int->void*->int->unit
-void cpdf_~(int pdf, void *data, int len) {
-  CAMLparam0();
+void cpdf_~64(int pdf, void *data, size_t len) {
+  CPDFparam0();
   CAMLlocal4(unit, bytestream, fn, valpdf);
-  bytestream =
-      caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data, len);
-  fn = *caml_named_value("~");
+  bytestream = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data,
+                                  (intnat)len);
+  NAMED_VALUE(fn, "~");
   valpdf = Val_int(pdf);
   unit = caml_callback2(fn, valpdf, bytestream);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
+void cpdf_~(int pdf, void *data, int len) { cpdf_~64(pdf, data, len); }
 */
 
 enum cpdf_papersize {
@@ -871,77 +945,708 @@ enum cpdf_join {
 
 /* CHAPTER 0. Preliminaries */
 
+/*
+ * The OCaml references holding the last error and its string, found at
+ * startup, so the error can be read after each call without calling back into
+ * OCaml.
+ */
+const value *cpdf_lastErrorRef = NULL;
+const value *cpdf_lastErrorStringRef = NULL;
+
+/*
+ * Thread-safe mode. Each call holds a lock for its duration, so calls from
+ * different threads are run one at a time. The lock is taken only by the
+ * outermost call on a thread, so a source or sink callback may call the
+ * library again. Each thread keeps its own copy of the error state. Once set,
+ * the mode stays on, so the flag never changes under a running thread.
+ *
+ * Between calls, no thread holds the OCaml runtime. Each call acquires it
+ * after taking the lock, and a thread other than the startup thread is
+ * registered with the runtime on its first call, and unregistered when it
+ * exits.
+ */
+int cpdf_threadSafe = 0;
+
+#ifdef _WIN32
+SRWLOCK cpdf_lock = SRWLOCK_INIT;
+#else
+pthread_mutex_t cpdf_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+_Thread_local int cpdf_lockDepth = 0;
+_Thread_local int cpdf_threadLastError = 0;
+_Thread_local char *cpdf_threadLastErrorString = NULL;
+_Thread_local int cpdf_threadRegistered = 0;
+
+/* The last string returned to this thread, in thread-safe mode. */
+_Thread_local char *cpdf_threadString = NULL;
+
+/*
+ * The context each thread has chosen with cpdf_setContext, and the one the
+ * OCaml side currently has in place.
+ */
+_Thread_local int cpdf_threadContext = 0;
+int cpdf_activeContext = 0;
+
+/*
+ * The number of threads which have chosen each context other than 0, so that
+ * a context current on any thread is not deleted.
+ */
+struct cpdf_contextUse {
+  int context;
+  int threads;
+  struct cpdf_contextUse *next;
+};
+
+struct cpdf_contextUse *cpdf_contextUses = NULL;
+
+struct cpdf_contextUse *findContextUse(int context) {
+  struct cpdf_contextUse *use = cpdf_contextUses;
+  while (use != NULL && use->context != context) use = use->next;
+  return use;
+}
+
+void addContextUse(int context, int n) {
+  struct cpdf_contextUse *use;
+  if (context == 0) return;
+  use = findContextUse(context);
+  if (use == NULL) {
+    use = malloc(sizeof(struct cpdf_contextUse));
+    if (use == NULL) return;
+    use->context = context;
+    use->threads = 0;
+    use->next = cpdf_contextUses;
+    cpdf_contextUses = use;
+  }
+  use->threads += n;
+}
+
+/*
+ * Run at the exit of a thread which has called the library, to give up the
+ * context it chose, free its storage and unregister it from the OCaml
+ * runtime. A thread which exits without setting context 0 again does not
+ * then keep its context from being deleted.
+ */
+#ifdef _WIN32
+DWORD cpdf_threadKey;
+
+void WINAPI threadExit(void *unused) {
+#else
+pthread_key_t cpdf_threadKey;
+
+void threadExit(void *unused) {
+#endif
+  if (cpdf_threadContext != 0) {
+#ifdef _WIN32
+    AcquireSRWLockExclusive(&cpdf_lock);
+    addContextUse(cpdf_threadContext, -1);
+    ReleaseSRWLockExclusive(&cpdf_lock);
+#else
+    pthread_mutex_lock(&cpdf_lock);
+    addContextUse(cpdf_threadContext, -1);
+    pthread_mutex_unlock(&cpdf_lock);
+#endif
+    cpdf_threadContext = 0;
+  }
+  free(cpdf_threadString);
+  cpdf_threadString = NULL;
+  free(cpdf_threadLastErrorString);
+  cpdf_threadLastErrorString = NULL;
+  caml_c_thread_unregister();
+}
+
+/*
+ * Turn on thread-safe mode, from the startup thread, before other threads
+ * call the library. The startup thread gives up the OCaml runtime, which is
+ * from then on taken by each call. Turning the mode off again is ignored.
+ */
+void cpdf_setThreadSafe(int threadsafe) {
+  if (!threadsafe || cpdf_threadSafe) return;
+#ifdef _WIN32
+  cpdf_threadKey = FlsAlloc(threadExit);
+#else
+  pthread_key_create(&cpdf_threadKey, threadExit);
+#endif
+  cpdf_threadRegistered = 1;
+  cpdf_threadSafe = 1;
+  caml_release_runtime_system();
+}
+
+/*
+ * Take the lock if in thread-safe mode and this is the outermost call, and
+ * put in place the context this thread last chose. The error left by another
+ * thread's call is cleared, so that the error state after a call belongs to
+ * that call alone. Not exposed in the interface.
+ */
+void enterLibrary(void) {
+  if (!cpdf_threadSafe) return;
+  if (cpdf_lockDepth++ > 0) return;
+  if (!cpdf_threadRegistered) {
+    caml_c_thread_register();
+#ifdef _WIN32
+    FlsSetValue(cpdf_threadKey, (void *)1);
+#else
+    pthread_setspecific(cpdf_threadKey, (void *)1);
+#endif
+    cpdf_threadRegistered = 1;
+  }
+#ifdef _WIN32
+  AcquireSRWLockExclusive(&cpdf_lock);
+#else
+  pthread_mutex_lock(&cpdf_lock);
+#endif
+  caml_acquire_runtime_system();
+  if (cpdf_threadContext != cpdf_activeContext) {
+    value fn;
+    NAMED_VALUE(fn, "setContext");
+    caml_callback(fn, Val_int(cpdf_threadContext));
+    cpdf_activeContext = cpdf_threadContext;
+  }
+  caml_modify((value *)&Field(*cpdf_lastErrorRef, 0), Val_int(0));
+}
+
+/* Release the lock taken by enterLibrary. Not exposed in the interface. */
+void leaveLibrary(void) {
+  if (cpdf_lockDepth == 0) return;
+  if (--cpdf_lockDepth > 0) return;
+  caml_release_runtime_system();
+#ifdef _WIN32
+  ReleaseSRWLockExclusive(&cpdf_lock);
+#else
+  pthread_mutex_unlock(&cpdf_lock);
+#endif
+}
+
 void cpdf_startup(char **argv) {
   caml_startup(argv);
+  cpdf_lastErrorRef = caml_named_value("lastError");
+  cpdf_lastErrorStringRef = caml_named_value("lastErrorString");
   return;
 }
 
 int cpdf_lastError = 0;
 char *cpdf_lastErrorString = "";
 
-/* For .NET and Java, which can't access data in DLLs, only functions. */
-int cpdf_fLastError(void) { return cpdf_lastError; }
+/*
+ * For .NET and Java, which can't access data in DLLs, only functions. In
+ * thread-safe mode, these give the calling thread's own error state.
+ */
+int cpdf_fLastError(void) {
+  return cpdf_threadSafe ? cpdf_threadLastError : cpdf_lastError;
+}
+
+char *cpdf_fLastErrorString(void) {
+  if (!cpdf_threadSafe) return cpdf_lastErrorString;
+  return cpdf_threadLastErrorString == NULL ? "" : cpdf_threadLastErrorString;
+}
+
+/*
+ * Buffers handed out directly in zero-copy mode. Each keeps its bigarray
+ * alive with a global root until released, so the data does not go away.
+ */
+struct cpdf_pinnedBuffer {
+  void *data;
+  value bytestream;
+  struct cpdf_pinnedBuffer *next;
+};
+
+struct cpdf_pinnedBuffer *cpdf_pinnedBuffers = NULL;
 
-char *cpdf_fLastErrorString(void) { return cpdf_lastErrorString; }
+int cpdf_zeroCopy = 0;
+
+void cpdf_setZeroCopy(int zerocopy) { cpdf_zeroCopy = zerocopy; }
+
+/*
+ * Release a buffer returned by the library. If it was pinned, drop the root
+ * so OCaml can collect it. Otherwise, it was copied, so free it.
+ */
+void cpdf_releaseBuffer(void *ptr) {
+  struct cpdf_pinnedBuffer **p;
+  enterLibrary();
+  p = &cpdf_pinnedBuffers;
+  while (*p != NULL) {
+    if ((*p)->data == ptr) {
+      struct cpdf_pinnedBuffer *found = *p;
+      *p = found->next;
+      caml_remove_generational_global_root(&found->bytestream);
+      free(found);
+      leaveLibrary();
+      return;
+    }
+    p = &(*p)->next;
+  }
+  leaveLibrary();
+  free(ptr);
+}
 
 /* For .NET, expose the C free function */
-void cpdf_free(void *ptr) { free(ptr); }
+void cpdf_free(void *ptr) { cpdf_releaseBuffer(ptr); }
+
+/*
+ * Give the contents of a bytestream from OCaml to the caller, filling in its
+ * size. In zero-copy mode, if the bytestream was built afresh for this call,
+ * the bigarray's own data is returned and pinned. Otherwise, for example when
+ * it is the data of a stream still in the PDF, which the caller could write
+ * through, it is copied into a fresh buffer. This function is not exposed in
+ * the interface.
+ */
+void *returnBytestream(value bytestream, size_t *size, int fresh,
+                       char *name) {
+  CAMLparam1(bytestream);
+  void *memory = NULL;
+  *size = Caml_ba_array_val(bytestream)->dim[0];
+  if (cpdf_zeroCopy && fresh && *size > 0) {
+    struct cpdf_pinnedBuffer *pinned = malloc(sizeof(struct cpdf_pinnedBuffer));
+    if (pinned != NULL) {
+      pinned->data = Caml_ba_data_val(bytestream);
+      pinned->bytestream = bytestream;
+      caml_register_generational_global_root(&pinned->bytestream);
+      pinned->next = cpdf_pinnedBuffers;
+      cpdf_pinnedBuffers = pinned;
+      CAMLreturnT(void *, pinned->data);
+    }
+  }
+  memory = malloc(*size);
+  if (memory == NULL && *size > 0)
+    fprintf(stderr, "%s: failed", name);
+  else if (*size > 0)
+    memcpy(memory, Caml_ba_data_val(bytestream), *size);
+  CAMLreturnT(void *, memory);
+}
 
 /*
  * Get the latest error from OCaml and replicate it here in C. Also update
  * the lastErrorString, This function is not exposed in the interface
  */
 void updateLastError(void) {
-  CAMLparam0();
-  CAMLlocal3(getLastError_v, unit_v, result_v);
-  CAMLlocal2(getLastErrorString_v, string_result_v);
-  getLastError_v = *caml_named_value("getLastError");
-  unit_v = Val_unit;
-  result_v = caml_callback(getLastError_v, unit_v);
-  cpdf_lastError = Int_val(result_v);
-  getLastErrorString_v = *caml_named_value("getLastErrorString");
-  string_result_v = caml_callback(getLastErrorString_v, unit_v);
-  cpdf_lastErrorString = (char *)String_val(string_result_v);
-  CAMLreturn0;
+  cpdf_lastError = Int_val(Field(*cpdf_lastErrorRef, 0));
+  cpdf_lastErrorString = (char *)String_val(Field(*cpdf_lastErrorStringRef, 0));
+  if (cpdf_threadSafe) {
+    cpdf_threadLastError = cpdf_lastError;
+    free(cpdf_threadLastErrorString);
+    cpdf_threadLastErrorString =
+        cpdf_lastError == 0 ? NULL : strdup(cpdf_lastErrorString);
+  }
+}
+
+/*
+ * Set an error from the C side, as handle_error does on the OCaml side. This
+ * function is not exposed in the interface.
+ */
+void setLastError(char *str) {
+  static char buf[256];
+  snprintf(buf, sizeof(buf), "ERROR: %s", str);
+  fprintf(stderr, "%s\n", buf);
+  cpdf_lastError = 1;
+  cpdf_lastErrorString = buf;
+  if (cpdf_threadSafe) {
+    cpdf_threadLastError = 1;
+    free(cpdf_threadLastErrorString);
+    cpdf_threadLastErrorString = strdup(buf);
+  }
+}
+
+/*
+ * Give the length of a returned buffer to a caller of an int variant. A
+ * buffer longer than INT_MAX cannot be described by an int, so it is
+ * released and an error set, naming the 64 variant to use instead. This
+ * function is not exposed in the interface.
+ */
+void *narrowLength(void *memory, size_t size, int *retlen, char *name) {
+  char str[128];
+  if (size <= INT_MAX) {
+    *retlen = (int)size;
+    return memory;
+  }
+  cpdf_releaseBuffer(memory);
+  *retlen = 0;
+  snprintf(str, sizeof(str), "%s: result too large for int, use %s64", name,
+           name);
+  setLastError(str);
+  return NULL;
+}
+
+/*
+ * Give an OCaml string to the caller. In thread-safe mode, the string may
+ * move or be collected once the lock is released, so it is copied into
+ * storage belonging to the calling thread, which lasts until that thread's
+ * next such call. This function is not exposed in the interface.
+ */
+char *returnString(value str) {
+  if (!cpdf_threadSafe) return (char *)String_val(str);
+  free(cpdf_threadString);
+  cpdf_threadString = strdup(String_val(str));
+  return cpdf_threadString == NULL ? "" : cpdf_threadString;
 }
 
 char *cpdf_version() {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal1(version);
-  version = *caml_named_value("version");
-  char *str = (char *)String_val(version);
-  CAMLreturnT(char *, str);
+  NAMED_VALUE(version, "version");
+  CPDFreturnT(char *, returnString(version));
 }
 
 void cpdf_clearError(void) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal3(clearError_v, unit_v, result_v);
-  clearError_v = *caml_named_value("clearError");
+  NAMED_VALUE(clearError_v, "clearError");
   unit_v = Val_unit;
   result_v = caml_callback(clearError_v, unit_v);
   cpdf_lastError = 0;
   cpdf_lastErrorString = "";
-  CAMLreturn0;
+  cpdf_threadLastError = 0;
+  free(cpdf_threadLastErrorString);
+  cpdf_threadLastErrorString = NULL;
+  CPDFreturn0;
 }
 
+/* __AUTO newContext unit->int */
+
+void cpdf_setContext(int context) {
+  CPDFparam0();
+  CAMLlocal1(fn);
+  NAMED_VALUE(fn, "setContext");
+  caml_callback(fn, Val_int(context));
+  updateLastError();
+  if (cpdf_lastError == 0) {
+    addContextUse(cpdf_threadContext, -1);
+    addContextUse(context, 1);
+    cpdf_threadContext = context;
+    cpdf_activeContext = context;
+  }
+  CPDFreturn0;
+}
+
+void cpdf_deleteContext(int context) {
+  CPDFparam0();
+  CAMLlocal1(fn);
+  struct cpdf_contextUse *use = findContextUse(context);
+  if (use != NULL && use->threads > 0) {
+    setLastError("deleteContext: context in use by a thread");
+    CPDFreturn0;
+  }
+  NAMED_VALUE(fn, "deleteContext");
+  caml_callback(fn, Val_int(context));
+  updateLastError();
+  CPDFreturn0;
+}
 /* __AUTO setFast unit->unit */
 /* __AUTO setSlow unit->unit */
 /* __AUTO embedStd14 int->unit */
 /* __AUTO embedStd14Dir string->unit */
 /* __AUTO onExit unit->unit */
 
+/*
+ * Called from OCaml to count the bytes used by everything reachable from a
+ * value: each block, plus the data of each bigarray, which is outside the
+ * OCaml heap. Closures and continuations are counted but not followed. Each
+ * block is visited once, using a table of addresses seen. Nothing is
+ * allocated on the OCaml heap during the walk, so blocks do not move. A
+ * bigarray is known by its custom operations, taken from one made before the
+ * walk starts, so that other custom blocks, such as mapped files, are not
+ * mistaken for one.
+ */
+struct cpdf_walk {
+  value *seen;
+  size_t seen_size;
+  size_t seen_count;
+  value *stack;
+  size_t stack_size;
+  size_t stack_count;
+};
+
+/* Add a block to the table of those seen. Returns false if already there. */
+int walkSee(struct cpdf_walk *w, value v) {
+  size_t i;
+  if (w->seen_count * 2 >= w->seen_size) {
+    size_t old_size = w->seen_size;
+    value *old = w->seen;
+    w->seen_size = old_size == 0 ? 1024 : old_size * 2;
+    w->seen = calloc(w->seen_size, sizeof(value));
+    if (w->seen == NULL) caml_failwith("reachableBytes: out of memory");
+    w->seen_count = 0;
+    for (i = 0; i < old_size; i++)
+      if (old[i] != 0) walkSee(w, old[i]);
+    free(old);
+  }
+  i = ((uintnat)v >> 3) * 2654435761u % w->seen_size;
+  while (w->seen[i] != 0) {
+    if (w->seen[i] == v) return 0;
+    i = (i + 1) % w->seen_size;
+  }
+  w->seen[i] = v;
+  w->seen_count++;
+  return 1;
+}
+
+void walkPush(struct cpdf_walk *w, value v) {
+  if (!Is_block(v) || !walkSee(w, v)) return;
+  if (w->stack_count == w->stack_size) {
+    w->stack_size = w->stack_size == 0 ? 1024 : w->stack_size * 2;
+    w->stack = realloc(w->stack, w->stack_size * sizeof(value));
+    if (w->stack == NULL) caml_failwith("reachableBytes: out of memory");
+  }
+  w->stack[w->stack_count++] = v;
+}
+
+value cpdflib_reachableBytes(value v) {
+  CAMLparam1(v);
+  CAMLlocal1(example);
+  struct cpdf_walk w = {NULL, 0, 0, NULL, 0, 0};
+  const struct custom_operations *bigarray_ops;
+  uintnat bytes = 0;
+  mlsize_t i;
+  example = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, NULL, 0);
+  bigarray_ops = Custom_ops_val(example);
+  walkPush(&w, v);
+  while (w.stack_count > 0) {
+    value b = w.stack[--w.stack_count];
+    tag_t tag = Tag_val(b);
+    if (tag == Infix_tag) continue; /* Inside a closure, counted with it */
+    bytes += Bhsize_wosize(Wosize_val(b));
+    if (tag == Custom_tag) {
+      if (Custom_ops_val(b) == bigarray_ops)
+        bytes += caml_ba_byte_size(Caml_ba_array_val(b));
+    } else if (tag < No_scan_tag && tag != Closure_tag
+#ifdef Cont_tag
+               && tag != Cont_tag
+#endif
+    ) {
+      for (i = 0; i < Wosize_val(b); i++) walkPush(&w, Field(b, i));
+    }
+  }
+  free(w.seen);
+  free(w.stack);
+  CAMLreturn(Val_long(bytes));
+}
+
+size_t cpdf_memoryUsage(int pdf) {
+  CPDFparam0();
+  CAMLlocal3(fn, pdf_v, out_v);
+  NAMED_VALUE(fn, "memoryUsage");
+  pdf_v = Val_int(pdf);
+  out_v = caml_callback(fn, pdf_v);
+  updateLastError();
+  CPDFreturnT(size_t, Long_val(out_v));
+}
+
+struct cpdf_memoryStats {
+  size_t heap_bytes;
+  size_t top_heap_bytes;
+  size_t minor_collections;
+  size_t major_collections;
+  size_t compactions;
+  int pdfs;
+  int ranges;
+};
+
+void cpdf_memoryStats(struct cpdf_memoryStats *stats) {
+  CPDFparam0();
+  CAMLlocal2(fn, out_v);
+  NAMED_VALUE(fn, "memoryStats");
+  out_v = caml_callback(fn, Val_unit);
+  updateLastError();
+  if (Wosize_val(out_v) == 7) {
+    stats->heap_bytes = Long_val(Field(out_v, 0));
+    stats->top_heap_bytes = Long_val(Field(out_v, 1));
+    stats->minor_collections = Long_val(Field(out_v, 2));
+    stats->major_collections = Long_val(Field(out_v, 3));
+    stats->compactions = Long_val(Field(out_v, 4));
+    stats->pdfs = Int_val(Field(out_v, 5));
+    stats->ranges = Int_val(Field(out_v, 6));
+  }
+  CPDFreturn0;
+}
+
 /* CHAPTER 1. Basics */
 
 /* __AUTO fromFile string->string->int */
 /* __AUTO fromFileLazy string->string->int */
 /* __AUTO fromMemory void*->int->string->int */
 /* __AUTO fromMemoryLazy void*->int->string->int */
+
+typedef int (*cpdf_source)(void *, size_t, void *, int);
+
+/*
+ * Sources in use, known to OCaml by number. A source lives until OCaml
+ * releases it, which, for a lazily-read PDF, is when the PDF is deleted.
+ */
+struct cpdf_sourceEntry {
+  int id;
+  cpdf_source read;
+  void *user_data;
+  struct cpdf_sourceEntry *next;
+};
+
+struct cpdf_sourceEntry *cpdf_sources = NULL;
+
+int cpdf_sourceKey = 0;
+
+int newSource(cpdf_source read, void *user_data) {
+  struct cpdf_sourceEntry *entry = malloc(sizeof(struct cpdf_sourceEntry));
+  if (entry == NULL) return 0;
+  entry->id = ++cpdf_sourceKey;
+  entry->read = read;
+  entry->user_data = user_data;
+  entry->next = cpdf_sources;
+  cpdf_sources = entry;
+  return entry->id;
+}
+
+/*
+ * Called from OCaml to read from a source into the buffer at the given
+ * position. The source may return fewer bytes than asked for.
+ */
+value cpdflib_readSource(value id_v, value offset_v, value buf_v, value pos_v,
+                         value len_v) {
+  CAMLparam5(id_v, offset_v, buf_v, pos_v, len_v);
+  struct cpdf_sourceEntry *entry = cpdf_sources;
+  intnat len = Long_val(len_v);
+  int got;
+  while (entry != NULL && entry->id != Int_val(id_v)) entry = entry->next;
+  if (entry == NULL) caml_failwith("readSource: no such source");
+  if (len > INT_MAX) len = INT_MAX;
+  got = entry->read(entry->user_data, Long_val(offset_v),
+                    Bytes_val(buf_v) + Long_val(pos_v), (int)len);
+  if (got < 0) caml_failwith("readSource: source reported an error");
+  if (got > len) caml_failwith("readSource: source returned too many bytes");
+  CAMLreturn(Val_int(got));
+}
+
+/* Called from OCaml when a source is no longer needed. */
+value cpdflib_releaseSource(value id_v) {
+  CAMLparam1(id_v);
+  struct cpdf_sourceEntry **p = &cpdf_sources;
+  while (*p != NULL) {
+    if ((*p)->id == Int_val(id_v)) {
+      struct cpdf_sourceEntry *found = *p;
+      *p = found->next;
+      free(found);
+      break;
+    }
+    p = &(*p)->next;
+  }
+  CAMLreturn(Val_unit);
+}
+
+int cpdf_fromSource(cpdf_source source, size_t length, void *user_data,
+                    int lazy, const char userpw[]) {
+  CPDFparam0();
+  CAMLlocal2(fn, result);
+  CAMLlocalN(args, 4);
+  int id = newSource(source, user_data);
+  NAMED_VALUE(fn, "fromSource");
+  args[0] = Val_int(id);
+  args[1] = Val_long(length);
+  args[2] = Val_bool(lazy);
+  args[3] = caml_copy_string(userpw);
+  result = caml_callbackN(fn, 4, args);
+  updateLastError();
+  CPDFreturnT(int, Int_val(result));
+}
+
+/*
+ * Memory-mapped files. The bigarray over a mapping is an external one with
+ * its own custom operations, whose finalizer unmaps the file. So the mapping
+ * lasts as long as anything can still reach the bigarray, such as objects
+ * yet to be read lazily by a PDF made from the mapped one, rather than until
+ * the mapped PDF is deleted.
+ */
+#ifndef _WIN32
+void cpdf_finalizeMapping(value v) {
+  struct caml_ba_array *b = Caml_ba_array_val(v);
+  munmap(b->data, (size_t)b->dim[0]);
+}
+
+struct custom_operations cpdf_mappingOps = {
+    "cpdf_mapping",         cpdf_finalizeMapping,
+    custom_compare_default, custom_hash_default,
+    custom_serialize_default, custom_deserialize_default,
+    custom_compare_ext_default, custom_fixed_length_default};
+#endif
+
+/* Called from OCaml to map a file read-only. Returns a bigarray over it. */
+value cpdflib_mapFile(value filename_v) {
+  CAMLparam1(filename_v);
+  CAMLlocal1(bytestream);
+#ifdef _WIN32
+  caml_failwith("mapFile: not available on this platform");
+#else
+  struct stat st;
+  void *data;
+  int fd = open(String_val(filename_v), O_RDONLY);
+  if (fd < 0) caml_failwith("mapFile: could not open file");
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    caml_failwith("mapFile: could not find length of file");
+  }
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) caml_failwith("mapFile: could not map file");
+  bytestream = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data,
+                                  (intnat)st.st_size);
+  Custom_ops_val(bytestream) = &cpdf_mappingOps;
+#endif
+  CAMLreturn(bytestream);
+}
+
+/*
+ * Called from OCaml to find the length and modification time of a file, by
+ * which the page count cache knows it.
+ */
+value cpdflib_fileIdentity(value filename_v) {
+  CAMLparam1(filename_v);
+  CAMLlocal2(mtime, result);
+  double seconds;
+  intnat size;
+#ifdef _WIN32
+  struct _stat64 st;
+  if (_stat64(String_val(filename_v), &st) != 0)
+    caml_failwith("fileIdentity: could not stat file");
+  seconds = (double)st.st_mtime;
+#else
+  struct stat st;
+  if (stat(String_val(filename_v), &st) != 0)
+    caml_failwith("fileIdentity: could not stat file");
+#ifdef __APPLE__
+  seconds = (double)st.st_mtimespec.tv_sec + st.st_mtimespec.tv_nsec / 1e9;
+#else
+  seconds = (double)st.st_mtim.tv_sec + st.st_mtim.tv_nsec / 1e9;
+#endif
+#endif
+  size = (intnat)st.st_size;
+  mtime = caml_copy_double(seconds);
+  result = caml_alloc(2, 0);
+  Store_field(result, 0, Val_long(size));
+  Store_field(result, 1, mtime);
+  CAMLreturn(result);
+}
+
+/* __AUTO fromFileMapped string->string->int */
+
 /* __AUTO deletePdf int->unit */
+/* __AUTO setGCParams int->int->int->unit */
+/* __AUTO compactHeap unit->unit */
+/* __AUTO fullMajor unit->unit */
+
+void cpdf_setCompactThreshold(size_t bytes) {
+  CPDFparam0();
+  CAMLlocal2(fn, unit);
+  NAMED_VALUE(fn, "setCompactThreshold");
+  unit = caml_callback(fn, Val_long(bytes));
+  updateLastError();
+  CPDFreturn0;
+}
+
 /* __AUTO replacePdf int->int->unit */
 /* __AUTO startEnumeratePDFs unit->int */
 /* __AUTO enumeratePDFsKey int->int */
 /* __AUTO enumeratePDFsInfo int->string */
 /* __AUTO endEnumeratePDFs unit->unit */
+/* __AUTO beginScope unit->unit */
+/* __AUTO endScope unit->unit */
+/* __AUTO numPdfs unit->int */
+/* __AUTO numRanges unit->int */
 /* __AUTO ptOfCm float->float */
 /* __AUTO ptOfMm float->float */
 /* __AUTO ptOfIn float->float */
@@ -963,31 +1668,67 @@ void cpdf_clearError(void) {
 /* __AUTO rangeLength int->int */
 /* __AUTO rangeGet int->int->int */
 /* __AUTO rangeAdd int->int->int */
+
+int cpdf_rangeFromArray(int *pages, int n) {
+  CPDFparam0();
+  CAMLlocal3(fn, array, out);
+  if (n < 0 || (pages == NULL && n > 0)) {
+    setLastError("rangeFromArray: bad array");
+    CPDFreturnT(int, 0);
+  }
+  array = caml_alloc(n, 0);
+  int x;
+  for (x = 0; x < n; x++) Store_field(array, x, Val_int(pages[x]));
+  NAMED_VALUE(fn, "rangeFromArray");
+  out = caml_callback(fn, array);
+  updateLastError();
+  CPDFreturnT(int, Int_val(out));
+}
+
+int cpdf_rangeToArray(int range, int *out) {
+  CPDFparam0();
+  CAMLlocal3(fn, range_v, array);
+  NAMED_VALUE(fn, "rangeToArray");
+  range_v = Val_int(range);
+  array = caml_callback(fn, range_v);
+  updateLastError();
+  int n = Wosize_val(array);
+  int x;
+  for (x = 0; x < n; x++) out[x] = Int_val(Field(array, x));
+  CPDFreturnT(int, n);
+}
 /* __AUTO isInRange int->int->int */
 /* __AUTO pages int->int */
 /* __AUTO pagesFast string->string->int */
+/* __AUTO setPagesFastCache int->unit */
+/* __AUTO pagesFastCacheHits unit->int */
+/* __AUTO pagesFastCacheMisses unit->int */
+
+/* __AUTO setRemoveUnreferenced int->unit */
 
 void cpdf_toFile(int pdf, char *filename, int linearize, int make_id) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn, unit);
   CAMLlocalN(args, 4);
   args[0] = Val_int(pdf);
   args[1] = caml_copy_string(filename);
   args[2] = Val_int(linearize);
   args[3] = Val_int(make_id);
-  fn = *caml_named_value("toFile");
+  NAMED_VALUE(fn, "toFile");
   unit = caml_callbackN(fn, 4, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 
+/* __AUTO toFileIncremental int->string->unit */
+
 void cpdf_toFileExt(int pdf, char *filename, int linearize, int make_id,
                     int preserve_objstm, int create_objstm,
                     int compress_objstm) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn, unit);
   CAMLlocalN(args, 7);
-  fn = *caml_named_value("toFileExt");
+  NAMED_VALUE(fn, "toFileExt");
   args[0] = Val_int(pdf);
   args[1] = caml_copy_string(filename);
   args[2] = Val_int(linearize);
@@ -997,31 +1738,116 @@ void cpdf_toFileExt(int pdf, char *filename, int linearize, int make_id,
   args[6] = Val_bool(compress_objstm);
   unit = caml_callbackN(fn, 7, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 
-void *cpdf_toMemory(int pdf, int linearize, int make_id, int *retlen) {
-  CAMLparam0();
+void *cpdf_toMemory64(int pdf, int linearize, int make_id, size_t *retlen) {
+  CPDFparam0();
   CAMLlocal5(fn, bytestream, pdf_v, linearize_v, make_id_v);
-  fn = *caml_named_value("toFileMemory");
+  NAMED_VALUE(fn, "toFileMemory");
   pdf_v = Val_int(pdf);
   linearize_v = Val_bool(linearize);
   make_id_v = Val_bool(make_id);
   bytestream = caml_callback3(fn, pdf_v, linearize_v, make_id_v);
   updateLastError();
-  char *memory = NULL;
-  int size = Caml_ba_array_val(bytestream)->dim[0];
-  memory = calloc(size, sizeof(char));
-  if (memory == NULL && size > 0) fprintf(stderr, "toMemory: failed");
-  if (size > 0) {
-    int x;
-    char *indata = Caml_ba_data_val(bytestream);
-    for (x = 0; x < size; x++) {
-      memory[x] = indata[x];
-    };
+  void *memory = returnBytestream(bytestream, retlen, 1, "toMemory");
+  CPDFreturnT(void *, memory);
+}
+
+void *cpdf_toMemory(int pdf, int linearize, int make_id, int *retlen) {
+  size_t size;
+  void *memory = cpdf_toMemory64(pdf, linearize, make_id, &size);
+  return narrowLength(memory, size, retlen, "toMemory");
+}
+
+typedef int (*cpdf_sink)(void *, const void *, size_t);
+
+/*
+ * Sinks in use, known to OCaml by number. A sink is registered for the
+ * duration of the call which writes to it.
+ */
+struct cpdf_sinkEntry {
+  int id;
+  cpdf_sink write;
+  void *user_data;
+  struct cpdf_sinkEntry *next;
+};
+
+struct cpdf_sinkEntry *cpdf_sinks = NULL;
+
+int cpdf_sinkKey = 0;
+
+int newSink(cpdf_sink write, void *user_data) {
+  struct cpdf_sinkEntry *entry = malloc(sizeof(struct cpdf_sinkEntry));
+  if (entry == NULL) return 0;
+  entry->id = ++cpdf_sinkKey;
+  entry->write = write;
+  entry->user_data = user_data;
+  entry->next = cpdf_sinks;
+  cpdf_sinks = entry;
+  return entry->id;
+}
+
+void deleteSink(int id) {
+  struct cpdf_sinkEntry **p = &cpdf_sinks;
+  while (*p != NULL) {
+    if ((*p)->id == id) {
+      struct cpdf_sinkEntry *found = *p;
+      *p = found->next;
+      free(found);
+      return;
+    }
+    p = &(*p)->next;
   }
-  *retlen = size;
-  CAMLreturnT(void *, memory);
+}
+
+/* Called from OCaml with each chunk of output for a sink. */
+value cpdflib_writeSink(value id_v, value buf_v, value len_v) {
+  CAMLparam3(id_v, buf_v, len_v);
+  struct cpdf_sinkEntry *entry = cpdf_sinks;
+  while (entry != NULL && entry->id != Int_val(id_v)) entry = entry->next;
+  if (entry == NULL) caml_failwith("writeSink: no such sink");
+  if (entry->write(entry->user_data, Bytes_val(buf_v), Long_val(len_v)) != 0)
+    caml_failwith("writeSink: sink reported an error");
+  CAMLreturn(Val_unit);
+}
+
+void cpdf_toSink(int pdf, cpdf_sink sink, void *user_data, int linearize,
+                 int make_id) {
+  CPDFparam0();
+  CAMLlocal2(fn, unit);
+  CAMLlocalN(args, 4);
+  int id = newSink(sink, user_data);
+  NAMED_VALUE(fn, "toSink");
+  args[0] = Val_int(pdf);
+  args[1] = Val_int(id);
+  args[2] = Val_bool(linearize);
+  args[3] = Val_bool(make_id);
+  unit = caml_callbackN(fn, 4, args);
+  deleteSink(id);
+  updateLastError();
+  CPDFreturn0;
+}
+
+void cpdf_toSinkExt(int pdf, cpdf_sink sink, void *user_data, int linearize,
+                    int make_id, int preserve_objstm, int create_objstm,
+                    int compress_objstm) {
+  CPDFparam0();
+  CAMLlocal2(fn, unit);
+  CAMLlocalN(args, 7);
+  int id = newSink(sink, user_data);
+  NAMED_VALUE(fn, "toSinkExt");
+  args[0] = Val_int(pdf);
+  args[1] = Val_int(id);
+  args[2] = Val_bool(linearize);
+  args[3] = Val_bool(make_id);
+  args[4] = Val_bool(preserve_objstm);
+  args[5] = Val_bool(create_objstm);
+  args[6] = Val_bool(compress_objstm);
+  unit = caml_callbackN(fn, 7, args);
+  deleteSink(id);
+  updateLastError();
+  CPDFreturn0;
 }
 
 /* __AUTO isEncrypted int->int */
@@ -1031,7 +1857,7 @@ void *cpdf_toMemory(int pdf, int linearize, int make_id, int *retlen) {
 void cpdf_toFileEncrypted(int pdf, int e, int *ps, int len, char *owner,
                           char *user, int linearize, int makeid,
                           char *filename) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal4(unit, fn, temp, permissions);
   CAMLlocalN(args, 8);
   permissions = caml_alloc(len, 0);
@@ -1048,10 +1874,10 @@ void cpdf_toFileEncrypted(int pdf, int e, int *ps, int len, char *owner,
   args[5] = Val_int(linearize);
   args[6] = Val_int(makeid);
   args[7] = caml_copy_string(filename);
-  fn = *caml_named_value("toFileEncrypted");
+  NAMED_VALUE(fn, "toFileEncrypted");
   unit = caml_callbackN(fn, 8, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 
 /* FIXME: Extend for recrypting at some point? */
@@ -1059,7 +1885,7 @@ void cpdf_toFileEncryptedExt(int pdf, int e, int *ps, int len, char *owner,
                              char *user, int linearize, int makeid,
                              int preserve_objstm, int generate_objstm,
                              int compress_objstm, char *filename) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal4(unit, fn, temp, permissions);
   CAMLlocalN(args, 11);
   permissions = caml_alloc(len, 0);
@@ -1079,10 +1905,10 @@ void cpdf_toFileEncryptedExt(int pdf, int e, int *ps, int len, char *owner,
   args[8] = Val_bool(generate_objstm);
   args[9] = Val_bool(compress_objstm);
   args[10] = caml_copy_string(filename);
-  fn = *caml_named_value("toFileEncryptedExt");
+  NAMED_VALUE(fn, "toFileEncryptedExt");
   unit = caml_callbackN(fn, 11, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 
 /* __AUTO hasPermission int->int->int */
@@ -1091,7 +1917,7 @@ void cpdf_toFileEncryptedExt(int pdf, int e, int *ps, int len, char *owner,
 /* CHAPTER 2. Merging and Splitting */
 
 int cpdf_mergeSimple(int *pdfs, int len) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal4(fn, array, temp, out);
   array = caml_alloc(len, 0);
   int x;
@@ -1099,15 +1925,15 @@ int cpdf_mergeSimple(int *pdfs, int len) {
     temp = Val_int(pdfs[x]);
     Store_field(array, x, temp);
   };
-  fn = *caml_named_value("mergeSimple");
+  NAMED_VALUE(fn, "mergeSimple");
   out = caml_callback(fn, array);
   updateLastError();
-  CAMLreturnT(int, Int_val(out));
+  CPDFreturnT(int, Int_val(out));
 }
 
 int cpdf_merge(int *pdfs, int len, int retain_numbering,
                int remove_duplicate_fonts) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal5(fn, array, temp, len_v, retain_numbering_v);
   CAMLlocal2(remove_duplicate_fonts_v, out);
   array = caml_alloc(len, 0);
@@ -1116,17 +1942,17 @@ int cpdf_merge(int *pdfs, int len, int retain_numbering,
     temp = Val_int(pdfs[x]);
     Store_field(array, x, temp);
   };
-  fn = *caml_named_value("merge");
+  NAMED_VALUE(fn, "merge");
   retain_numbering_v = Val_int(retain_numbering);
   remove_duplicate_fonts_v = Val_int(remove_duplicate_fonts);
   out = caml_callback3(fn, array, retain_numbering_v, remove_duplicate_fonts_v);
   updateLastError();
-  CAMLreturnT(int, Int_val(out));
+  CPDFreturnT(int, Int_val(out));
 }
 
 int cpdf_mergeSame(int *pdfs, int len, int retain_numbering,
                    int remove_duplicate_fonts, int *ranges) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal3(array, rangearray, fn);
   CAMLlocal2(temp, out);
   CAMLlocalN(args, 4);
@@ -1141,18 +1967,78 @@ int cpdf_mergeSame(int *pdfs, int len, int retain_numbering,
     temp = Val_int(ranges[x]);
     Store_field(rangearray, x, temp);
   };
-  fn = *caml_named_value("mergeSame");
+  NAMED_VALUE(fn, "mergeSame");
   args[0] = array;
   args[1] = Val_int(retain_numbering);
   args[2] = Val_int(remove_duplicate_fonts);
   args[3] = rangearray;
   out = caml_callbackN(fn, 4, args);
   updateLastError();
-  CAMLreturnT(int, Int_val(out));
+  CPDFreturnT(int, Int_val(out));
 }
 
 /* __AUTO selectPages int->int->int */
 
+int cpdf_mergeBegin(cpdf_sink sink, void *user_data) {
+  CPDFparam0();
+  CAMLlocal2(fn, out);
+  int id = newSink(sink, user_data);
+  NAMED_VALUE(fn, "mergeBegin");
+  out = caml_callback(fn, Val_int(id));
+  updateLastError();
+  if (Int_val(out) == 0) deleteSink(id);
+  CPDFreturnT(int, Int_val(out));
+}
+
+/* __AUTO mergeDeduplicate int->int->unit */
+/* __AUTO mergeAppendFile int->string->string->unit */
+
+void cpdf_mergeAppendMemory64(int merge, void *data, size_t len, char *userpw) {
+  CPDFparam0();
+  CAMLlocal4(fn, bytestream, userpw_v, unit);
+  bytestream = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data,
+                                  (intnat)len);
+  NAMED_VALUE(fn, "mergeAppendMemory");
+  userpw_v = caml_copy_string(userpw);
+  unit = caml_callback3(fn, Val_int(merge), bytestream, userpw_v);
+  updateLastError();
+  CPDFreturn0;
+}
+
+void cpdf_mergeAppendMemory(int merge, void *data, int len, char *userpw) {
+  cpdf_mergeAppendMemory64(merge, data, len, userpw);
+}
+
+void cpdf_mergeEndToSink(int merge) {
+  CPDFparam0();
+  CAMLlocal2(fn, out);
+  NAMED_VALUE(fn, "mergeEnd");
+  out = caml_callback(fn, Val_int(merge));
+  updateLastError();
+  if (Int_val(out) != 0) deleteSink(Int_val(out));
+  CPDFreturn0;
+}
+
+void cpdf_splitToFiles(int pdf, int *ranges, int len, const char *filename) {
+  CPDFparam0();
+  CAMLlocal3(rangearray, temp, fn);
+  CAMLlocal2(valfilename, unit);
+  rangearray = caml_alloc(len, 0);
+  int x;
+  for (x = 0; x < len; x++) {
+    temp = Val_int(ranges[x]);
+    Store_field(rangearray, x, temp);
+  };
+  valfilename = caml_copy_string(filename);
+  NAMED_VALUE(fn, "splitToFiles");
+  unit = caml_callback3(fn, Val_int(pdf), rangearray, valfilename);
+  updateLastError();
+  CPDFreturn0;
+}
+
+/* __AUTO splitToFilesBySize int->int->string->unit */
+/* __AUTO splitToFilesOnBookmarks int->int->int->string->unit */
+
 /* CHAPTER 3. Pages */
 
 /* __AUTO scalePages int->int->float->float->unit */
@@ -1161,7 +2047,7 @@ int cpdf_mergeSame(int *pdfs, int len, int retain_numbering,
 
 void cpdf_scaleContents(int pdf, int range, struct cpdf_position pos,
                         double scale) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocalN(args, 6);
   CAMLlocal3(unit, camlpos, fn);
   args[0] = Val_int(pdf);
@@ -1170,10 +2056,10 @@ void cpdf_scaleContents(int pdf, int range, struct cpdf_position pos,
   args[3] = caml_copy_double(pos.cpdf_coord1);
   args[4] = caml_copy_double(pos.cpdf_coord2);
   args[5] = caml_copy_double(scale);
-  fn = *caml_named_value("scaleContents");
+  NAMED_VALUE(fn, "scaleContents");
   unit = caml_callbackN(fn, 6, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 
 /* __AUTO shiftContents int->int->float->float->unit */
@@ -1195,6 +2081,146 @@ void cpdf_scaleContents(int pdf, int range, struct cpdf_position pos,
 
 /* CHAPTER 5. Compression */
 
+/*
+ * A buffer to be deflated by cpdflib_deflateMany. The input is the data of a
+ * bigarray, which does not move, so worker threads may read it without
+ * touching the OCaml runtime. The output is allocated with malloc.
+ */
+struct cpdf_deflateJob {
+  unsigned char *in;
+  size_t inlength;
+  unsigned char *out;
+  size_t outlength;
+  int ok;
+};
+
+struct cpdf_deflateWorker {
+  struct cpdf_deflateJob *jobs;
+  int njobs;
+  int first;
+  int step;
+  int level;
+};
+
+static void deflateJob(struct cpdf_deflateJob *job, int level) {
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  job->ok = 0;
+  if (deflateInit(&z, level) != Z_OK) return;
+  job->out = malloc(deflateBound(&z, job->inlength));
+  if (job->out != NULL) {
+    z.next_in = job->in;
+    z.avail_in = job->inlength;
+    z.next_out = job->out;
+    z.avail_out = deflateBound(&z, job->inlength);
+    if (deflate(&z, Z_FINISH) == Z_STREAM_END) {
+      /* Give back the slack between deflateBound and the actual length. */
+      unsigned char *shrunk = realloc(job->out, z.total_out);
+      if (shrunk != NULL) job->out = shrunk;
+      job->outlength = z.total_out;
+      job->ok = 1;
+    }
+  }
+  deflateEnd(&z);
+}
+
+/* Worker n of k deflates jobs n, n + k, n + 2k... */
+#ifdef _WIN32
+static DWORD WINAPI deflateWorker(LPVOID arg) {
+#else
+static void *deflateWorker(void *arg) {
+#endif
+  struct cpdf_deflateWorker *w = arg;
+  for (int x = w->first; x < w->njobs; x += w->step)
+    deflateJob(&w->jobs[x], w->level);
+  return 0;
+}
+
+/*
+ * Called from OCaml with an array of buffers, a compression level and a
+ * number of threads. Returns an array of the deflated buffers. Only this
+ * thread uses the OCaml runtime: the workers see nothing but the job table.
+ */
+value cpdflib_deflateMany(value inputs_v, value level_v, value threads_v) {
+  CAMLparam3(inputs_v, level_v, threads_v);
+  CAMLlocal2(result, bytestream);
+  int njobs = Wosize_val(inputs_v);
+  int nthreads = Int_val(threads_v);
+  int failed = 0;
+  struct cpdf_deflateJob *jobs;
+  struct cpdf_deflateWorker *workers;
+  if (nthreads > njobs) nthreads = njobs;
+  if (nthreads < 1) nthreads = 1;
+  jobs = calloc(njobs + 1, sizeof(struct cpdf_deflateJob));
+  workers = calloc(nthreads, sizeof(struct cpdf_deflateWorker));
+  if (jobs == NULL || workers == NULL) {
+    free(jobs);
+    free(workers);
+    caml_failwith("deflateMany: out of memory");
+  }
+  for (int x = 0; x < njobs; x++) {
+    jobs[x].in = Caml_ba_data_val(Field(inputs_v, x));
+    jobs[x].inlength = caml_ba_byte_size(Caml_ba_array_val(Field(inputs_v, x)));
+  }
+  for (int x = 0; x < nthreads; x++) {
+    workers[x].jobs = jobs;
+    workers[x].njobs = njobs;
+    workers[x].first = x;
+    workers[x].step = nthreads;
+    workers[x].level = Int_val(level_v);
+  }
+  /* This thread is worker zero. A thread which cannot be started leaves its
+   * jobs undone, and they are then done here. */
+  {
+#ifdef _WIN32
+    HANDLE *handles = calloc(nthreads, sizeof(HANDLE));
+    for (int x = 1; x < nthreads && handles != NULL; x++)
+      handles[x] = CreateThread(NULL, 0, deflateWorker, &workers[x], 0, NULL);
+    deflateWorker(&workers[0]);
+    for (int x = 1; x < nthreads && handles != NULL; x++)
+      if (handles[x] != NULL) {
+        WaitForSingleObject(handles[x], INFINITE);
+        CloseHandle(handles[x]);
+      }
+    free(handles);
+#else
+    pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+    int *started = calloc(nthreads, sizeof(int));
+    for (int x = 1; x < nthreads && threads != NULL && started != NULL; x++)
+      started[x] =
+          pthread_create(&threads[x], NULL, deflateWorker, &workers[x]) == 0;
+    deflateWorker(&workers[0]);
+    for (int x = 1; x < nthreads && threads != NULL && started != NULL; x++)
+      if (started[x]) pthread_join(threads[x], NULL);
+    free(threads);
+    free(started);
+#endif
+  }
+  for (int x = 0; x < njobs; x++)
+    if (!jobs[x].ok && jobs[x].out == NULL) deflateJob(&jobs[x], Int_val(level_v));
+  for (int x = 0; x < njobs; x++)
+    if (!jobs[x].ok) failed = 1;
+  if (failed) {
+    for (int x = 0; x < njobs; x++) free(jobs[x].out);
+    free(jobs);
+    free(workers);
+    caml_failwith("deflateMany: compression failed");
+  }
+  /* Hand each output to OCaml, which frees it when the bigarray dies. */
+  result = caml_alloc(njobs, 0);
+  for (int x = 0; x < njobs; x++) {
+    bytestream = caml_ba_alloc_dims(
+        CAML_BA_UINT8 | CAML_BA_C_LAYOUT | CAML_BA_MANAGED, 1, jobs[x].out,
+        (intnat)jobs[x].outlength);
+    jobs[x].out = NULL;
+    Store_field(result, x, bytestream);
+  }
+  free(jobs);
+  free(workers);
+  CAMLreturn(result);
+}
+
+/* __AUTO setCompressionThreads int->unit */
 /* __AUTO compress int->unit */
 /* __AUTO decompress int->unit */
 /* __AUTO squeezeInMemory int->unit */
@@ -1230,10 +2256,10 @@ void cpdf_scaleContents(int pdf, int range, struct cpdf_position pos,
 void cpdf_stampExtended(int pdf, int pdf2, int range, int isover,
                         int scale_stamp_to_fit, struct cpdf_position pos,
                         int relative_to_cropbox) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn, unit);
   CAMLlocalN(args, 9);
-  fn = *caml_named_value("stampExtended");
+  NAMED_VALUE(fn, "stampExtended");
   args[0] = Val_int(pdf);
   args[1] = Val_int(pdf2);
   args[2] = Val_int(range);
@@ -1245,7 +2271,7 @@ void cpdf_stampExtended(int pdf, int pdf2, int range, int isover,
   args[8] = Val_int(relative_to_cropbox);
   unit = caml_callbackN(fn, 9, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 
 /* __AUTO combinePages int->int->int */
@@ -1257,10 +2283,10 @@ void cpdf_addText(int metrics, int pdf, int range, char *text,
                   double opacity, enum cpdf_justification justification,
                   int midline, int topline, char *filename, double linewidth,
                   int embed_fonts) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn, unit);
   CAMLlocalN(args, 24);
-  fn = *caml_named_value("addText");
+  NAMED_VALUE(fn, "addText");
   args[0] = Val_int(metrics);
   args[1] = Val_int(pdf);
   args[2] = Val_int(range);
@@ -1287,13 +2313,13 @@ void cpdf_addText(int metrics, int pdf, int range, char *text,
   args[23] = Val_int(embed_fonts);
   unit = caml_callbackN(fn, 24, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 
 void cpdf_addTextSimple(int pdf, int range, char *text,
                         struct cpdf_position pos, char* font,
                         double fontsize) {
-  CAMLparam0();
+  CPDFparam0();
   char s[] = "";
   cpdf_addText(0,
                /* Do not collect metrics, but add text */
@@ -1326,7 +2352,7 @@ void cpdf_addTextSimple(int pdf, int range, char *text,
                0
                /* don't embed fonts */
   );
-  CAMLreturn0;
+  CPDFreturn0;
 }
 
 /* __AUTO removeText int->int->int */
@@ -1339,7 +2365,7 @@ void cpdf_addTextSimple(int pdf, int range, char *text,
 void cpdf_impose(int pdf, double x, double y, int fit, int columns, int rtl,
                  int btt, int center, double margin, double spacing,
                  double linewidth) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocalN(args, 11);
   args[0] = Val_int(pdf);
   args[1] = caml_copy_double(x);
@@ -1353,10 +2379,10 @@ void cpdf_impose(int pdf, double x, double y, int fit, int columns, int rtl,
   args[9] = caml_copy_double(spacing);
   args[10] = caml_copy_double(linewidth);
   CAMLlocal2(fn, out_v);
-  fn = *caml_named_value("impose");
+  NAMED_VALUE(fn, "impose");
   out_v = caml_callbackN(fn, 11, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 
 /* __AUTO twoUp int->unit */
@@ -1424,11 +2450,11 @@ void cpdf_impose(int pdf, double x, double y, int fit, int columns, int rtl,
 void cpdf_getDateComponents(char *date, int *year, int *month, int *day,
                             int *hour, int *minute, int *second,
                             int *hour_offset, int *minute_offset) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal5(fn, str_v, out_v, year_v, month_v);
   CAMLlocal5(day_v, hour_v, minute_v, second_v, hour_offset_v);
   CAMLlocal1(minute_offset_v);
-  fn = *caml_named_value("getDateComponents");
+  NAMED_VALUE(fn, "getDateComponents");
   str_v = caml_copy_string(date);
   out_v = caml_callback(fn, str_v);
   updateLastError();
@@ -1448,13 +2474,13 @@ void cpdf_getDateComponents(char *date, int *year, int *month, int *day,
   *second = Int_val(second_v);
   *hour_offset = Int_val(hour_offset_v);
   *minute_offset = Int_val(minute_offset_v);
-  CAMLreturn0;
+  CPDFreturn0;
 }
 
 char *cpdf_dateStringOfComponents(int year, int month, int day, int hour,
                                   int minute, int second, int hour_offset,
                                   int minute_offset) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocalN(args, 8);
   CAMLlocal2(fn, string_out);
   args[0] = Val_int(year);
@@ -1465,10 +2491,10 @@ char *cpdf_dateStringOfComponents(int year, int month, int day, int hour,
   args[5] = Val_int(second);
   args[6] = Val_int(hour_offset);
   args[7] = Val_int(minute_offset);
-  fn = *caml_named_value("dateStringOfComponents");
+  NAMED_VALUE(fn, "dateStringOfComponents");
   string_out = caml_callbackN(fn, 8, args);
   updateLastError();
-  CAMLreturnT(char *, (char *)String_val(string_out));
+  CPDFreturnT(char *, returnString(string_out));
 }
 
 /* __AUTO getPageRotation int->int->int */
@@ -1479,6 +2505,60 @@ char *cpdf_dateStringOfComponents(int year, int month, int day, int hour,
 /* __AUTO getTrimBox int->int->float*->float*->float*->float*->unit */
 /* __AUTO getArtBox int->int->float*->float*->float*->float*->unit */
 /* __AUTO getBleedBox int->int->float*->float*->float*->float*->unit */
+
+struct cpdf_box {
+  double minx;
+  double maxx;
+  double miny;
+  double maxy;
+};
+
+struct cpdf_pageGeometry {
+  int pagenumber;
+  struct cpdf_box mediabox;
+  struct cpdf_box cropbox;
+  struct cpdf_box trimbox;
+  struct cpdf_box artbox;
+  struct cpdf_box bleedbox;
+  int rotation;
+  int annotations;
+  int fonts;
+  int xobjects;
+};
+
+/* Fill in a box from four consecutive fields of a float array */
+void boxOfFloatArray(struct cpdf_box *box, value arr, int n) {
+  box->minx = Double_field(arr, n);
+  box->maxx = Double_field(arr, n + 1);
+  box->miny = Double_field(arr, n + 2);
+  box->maxy = Double_field(arr, n + 3);
+}
+
+int cpdf_getPageGeometryBatch(int pdf, int range,
+                              struct cpdf_pageGeometry *out) {
+  CPDFparam0();
+  CAMLlocal4(fn, pdf_v, range_v, arr_v);
+  NAMED_VALUE(fn, "getPageGeometry");
+  pdf_v = Val_int(pdf);
+  range_v = Val_int(range);
+  arr_v = caml_callback2(fn, pdf_v, range_v);
+  updateLastError();
+  int pages = Wosize_val(arr_v) / Double_wosize / 25;
+  for (int x = 0; x < pages; x++) {
+    int n = x * 25;
+    out[x].pagenumber = Double_field(arr_v, n);
+    boxOfFloatArray(&out[x].mediabox, arr_v, n + 1);
+    boxOfFloatArray(&out[x].cropbox, arr_v, n + 5);
+    boxOfFloatArray(&out[x].trimbox, arr_v, n + 9);
+    boxOfFloatArray(&out[x].artbox, arr_v, n + 13);
+    boxOfFloatArray(&out[x].bleedbox, arr_v, n + 17);
+    out[x].rotation = Double_field(arr_v, n + 21);
+    out[x].annotations = Double_field(arr_v, n + 22);
+    out[x].fonts = Double_field(arr_v, n + 23);
+    out[x].xobjects = Double_field(arr_v, n + 24);
+  }
+  CPDFreturnT(int, pages);
+}
 /* __AUTO setMediabox int->int->float->float->float->float->unit */
 /* __AUTO setCropBox int->int->float->float->float->float->unit */
 /* __AUTO setTrimBox int->int->float->float->float->float->unit */
@@ -1511,7 +2591,7 @@ char *cpdf_dateStringOfComponents(int year, int month, int day, int hour,
 /* __AUTO nonFullScreenPageMode int->int->unit */
 /* __AUTO setMetadataFromFile int->string->unit */
 /* __AUTO setMetadataFromByteArray int->void*->int->unit */
-/* __AUTO getMetadata int->int*->void* */
+/* __AUTO getMetadata int->int*->copied */
 /* __AUTO removeMetadata int->unit */
 /* __AUTO createMetadata int->unit */
 /* __AUTO setMetadataDate int->string->unit */
@@ -1531,35 +2611,45 @@ char *cpdf_dateStringOfComponents(int year, int month, int day, int hour,
 /* __AUTO attachFile string->int->unit */
 /* __AUTO attachFileToPage string->int->int->unit */
 
-void cpdf_attachFileFromMemory(void *data, int length, char *filename,
-                               int pdf) {
-  CAMLparam0();
+void cpdf_attachFileFromMemory64(void *data, size_t length, char *filename,
+                                 int pdf) {
+  CPDFparam0();
   CAMLlocal5(unit_v, fn, filename_v, bytestream_v, pdf_v);
-  fn = *caml_named_value("attachFileFromMemory");
-  bytestream_v =
-      caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data, length);
+  NAMED_VALUE(fn, "attachFileFromMemory");
+  bytestream_v = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data,
+                                    (intnat)length);
   filename_v = caml_copy_string(filename);
   pdf_v = Val_int(pdf);
   unit_v = caml_callback3(fn, bytestream_v, filename_v, pdf_v);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
 }
 
-void cpdf_attachFileToPageFromMemory(void *data, int length, char *filename,
-                                     int pdf, int page) {
-  CAMLparam0();
+void cpdf_attachFileFromMemory(void *data, int length, char *filename,
+                               int pdf) {
+  cpdf_attachFileFromMemory64(data, length, filename, pdf);
+}
+
+void cpdf_attachFileToPageFromMemory64(void *data, size_t length,
+                                       char *filename, int pdf, int page) {
+  CPDFparam0();
   CAMLlocal3(unit_v, fn, filename_v);
   CAMLlocal3(bytestream_v, pdf_v, page_v);
   CAMLlocalN(args, 4);
-  fn = *caml_named_value("attachFileToPageFromMemory");
-  args[0] = bytestream_v =
-      caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data, length);
+  NAMED_VALUE(fn, "attachFileToPageFromMemory");
+  args[0] = bytestream_v = caml_ba_alloc_dims(
+      CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data, (intnat)length);
   args[1] = filename_v = caml_copy_string(filename);
   args[2] = Val_int(pdf);
   args[3] = Val_int(page);
   unit_v = caml_callbackN(fn, 4, args);
   updateLastError();
-  CAMLreturn0;
+  CPDFreturn0;
+}
+
+void cpdf_attachFileToPageFromMemory(void *data, int length, char *filename,
+                                     int pdf, int page) {
+  cpdf_attachFileToPageFromMemory64(data, length, filename, pdf, page);
 }
 
 /* __AUTO removeAttachedFiles int->unit */
@@ -1567,7 +2657,7 @@ void cpdf_attachFileToPageFromMemory(void *data, int length, char *filename,
 /* __AUTO numberGetAttachments unit->int */
 /* __AUTO getAttachmentName int->string */
 /* __AUTO getAttachmentPage int->int */
-/* __AUTO getAttachmentData int->int*->void* */
+/* __AUTO getAttachmentData int->int*->copied */
 /* __AUTO endGetAttachments unit->unit */
 
 /* CHAPTER 13. Images */
@@ -1614,7 +2704,7 @@ void cpdf_attachFileToPageFromMemory(void *data, int length, char *filename,
 
 void cpdf_outputJSON(char *filename, int parse_content, int no_stream_data,
                      int decompress_streams, int pdf) {
-  CAMLparam0();
+  CPDFparam0();
   CAMLlocal2(fn, out);
   CAMLlocalN(args, 5);
   args[0] = caml_copy_string(filename);
@@ -1622,49 +2712,50 @@ void cpdf_outputJSON(char *filename, int parse_content, int no_stream_data,
   args[2] = Val_int(no_stream_data);
   args[3] = Val_int(decompress_streams);
   args[4] = Val_int(pdf);
-  fn = *caml_named_value("outputJSON");
+  NAMED_VALUE(fn, "outputJSON");
   out = caml_callbackN(fn, 5, args);
-  CAMLreturn0;
+  CPDFreturn0;
 }
 
-void *cpdf_outputJSONMemory(int pdf, int parse_content, int no_stream_data,
-                            int decompress_streams, int *retlen) {
-  CAMLparam0();
+void *cpdf_outputJSONMemory64(int pdf, int parse_content, int no_stream_data,
+                              int decompress_streams, size_t *retlen) {
+  CPDFparam0();
   CAMLlocal2(fn, bytestream);
   CAMLlocalN(args, 4);
   args[0] = Val_int(parse_content);
   args[1] = Val_int(no_stream_data);
   args[2] = Val_int(decompress_streams);
   args[3] = Val_int(pdf);
-  fn = *caml_named_value("outputJSONMemory");
+  NAMED_VALUE(fn, "outputJSONMemory");
   bytestream = caml_callbackN(fn, 4, args);
   updateLastError();
-  char *memory = NULL;
-  int size = Caml_ba_array_val(bytestream)->dim[0];
-  memory = calloc(size, sizeof(char));
-  if (memory == NULL && size > 0) fprintf(stderr, "outputJSONMemory: failed");
-  if (size > 0) {
-    int x;
-    char *indata = Caml_ba_data_val(bytestream);
-    for (x = 0; x < size; x++) {
-      memory[x] = indata[x];
-    };
-  }
-  *retlen = size;
-  CAMLreturnT(void *, memory);
+  void *memory = returnBytestream(bytestream, retlen, 1, "outputJSONMemory");
+  CPDFreturnT(void *, memory);
+}
+
+void *cpdf_outputJSONMemory(int pdf, int parse_content, int no_stream_data,
+                            int decompress_streams, int *retlen) {
+  size_t size;
+  void *memory = cpdf_outputJSONMemory64(pdf, parse_content, no_stream_data,
+                                         decompress_streams, &size);
+  return narrowLength(memory, size, retlen, "outputJSONMemory");
 }
 
 /* __AUTO fromJSON string->int */
 
-int cpdf_fromJSONMemory(void *data, int len) {
-  CAMLparam0();
+int cpdf_fromJSONMemory64(void *data, size_t len) {
+  CPDFparam0();
   CAMLlocal3(pdf_v, bytestream, fn);
-  bytestream =
-      caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data, len);
-  fn = *caml_named_value("fromJSONMemory");
+  bytestream = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data,
+                                  (intnat)len);
+  NAMED_VALUE(fn, "fromJSONMemory");
   pdf_v = caml_callback(fn, bytestream);
   updateLastError();
-  CAMLreturnT(int, Int_val(pdf_v));
+  CPDFreturnT(int, Int_val(pdf_v));
+}
+
+int cpdf_fromJSONMemory(void *data, int len) {
+  return cpdf_fromJSONMemory64(data, len);
 }
 
 /* CHAPTER 16. Optional Content Groups */
@@ -1686,55 +2777,73 @@ int cpdf_fromJSONMemory(void *data, int len) {
 /* __AUTO fromPNG string->int */
 /* __AUTO fromJPEG string->int */
 
-int cpdf_textToPDFMemory(double w, double h, char* font, double fontsize, void *data, int len) {
-  CAMLparam0();
+int cpdf_textToPDFMemory64(double w, double h, char* font, double fontsize, void *data, size_t len) {
+  CPDFparam0();
   CAMLlocal2(fn, pdf_v);
   CAMLlocalN(args, 5);
   args[0] = caml_copy_double(w);
   args[1] = caml_copy_double(h);
   args[2] = caml_copy_string(font);
   args[3] = caml_copy_double(fontsize);
-  args[4] = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data, len);
-  fn = *caml_named_value("textToPDFMemory");
+  args[4] = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data,
+                               (intnat)len);
+  NAMED_VALUE(fn, "textToPDFMemory");
   pdf_v = caml_callbackN(fn, 5, args);
   updateLastError();
-  CAMLreturnT(int, Int_val(pdf_v));
+  CPDFreturnT(int, Int_val(pdf_v));
 }
 
-int cpdf_textToPDFPaperMemory(int papersize, char* font, double fontsize, void *data, int len) {
-  CAMLparam0();
+int cpdf_textToPDFMemory(double w, double h, char* font, double fontsize, void *data, int len) {
+  return cpdf_textToPDFMemory64(w, h, font, fontsize, data, len);
+}
+
+int cpdf_textToPDFPaperMemory64(int papersize, char* font, double fontsize, void *data, size_t len) {
+  CPDFparam0();
   CAMLlocal2(fn, pdf_v);
   CAMLlocalN(args, 4);
   args[0] = Val_int(papersize);
   args[1] = caml_copy_string(font);
   args[2] = caml_copy_double(fontsize);
-  args[3] = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data, len);
-  fn = *caml_named_value("textToPDFPaperMemory");
+  args[3] = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data,
+                               (intnat)len);
+  NAMED_VALUE(fn, "textToPDFPaperMemory");
   pdf_v = caml_callbackN(fn, 4, args);
   updateLastError();
-  CAMLreturnT(int, Int_val(pdf_v));
+  CPDFreturnT(int, Int_val(pdf_v));
 }
 
-int cpdf_fromPNGMemory(void *data, int len) {
-  CAMLparam0();
+int cpdf_textToPDFPaperMemory(int papersize, char* font, double fontsize, void *data, int len) {
+  return cpdf_textToPDFPaperMemory64(papersize, font, fontsize, data, len);
+}
+
+int cpdf_fromPNGMemory64(void *data, size_t len) {
+  CPDFparam0();
   CAMLlocal3(pdf_v, bytestream, fn);
-  bytestream =
-      caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data, len);
-  fn = *caml_named_value("fromPNGMemory");
+  bytestream = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data,
+                                  (intnat)len);
+  NAMED_VALUE(fn, "fromPNGMemory");
   pdf_v = caml_callback(fn, bytestream);
   updateLastError();
-  CAMLreturnT(int, Int_val(pdf_v));
+  CPDFreturnT(int, Int_val(pdf_v));
 }
 
-int cpdf_fromJPEGMemory(void *data, int len) {
-  CAMLparam0();
+int cpdf_fromPNGMemory(void *data, int len) {
+  return cpdf_fromPNGMemory64(data, len);
+}
+
+int cpdf_fromJPEGMemory64(void *data, size_t len) {
+  CPDFparam0();
   CAMLlocal3(pdf_v, bytestream, fn);
-  bytestream =
-      caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data, len);
-  fn = *caml_named_value("fromJPEGMemory");
+  bytestream = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data,
+                                  (intnat)len);
+  NAMED_VALUE(fn, "fromJPEGMemory");
   pdf_v = caml_callback(fn, bytestream);
   updateLastError();
-  CAMLreturnT(int, Int_val(pdf_v));
+  CPDFreturnT(int, Int_val(pdf_v));
+}
+
+int cpdf_fromJPEGMemory(void *data, int len) {
+  return cpdf_fromJPEGMemory64(data, len);
 }
 
 /* CHAPTER 18. Drawing on PDFs */
@@ -1783,28 +2892,36 @@ int cpdf_fromJPEGMemory(void *data, int len) {
 /* __AUTO drawJPEG string->string->unit */
 /* __AUTO drawPNG string->string->unit */
 
-int cpdf_drawJPEGMemory(char *name, void *data, int len) {
-  CAMLparam0();
-  CAMLlocal4(pdf_v, name_v, bytestream, fn);
+void cpdf_drawJPEGMemory64(char *name, void *data, size_t len) {
+  CPDFparam0();
+  CAMLlocal4(unit_v, name_v, bytestream, fn);
   name_v = caml_copy_string(name);
-  bytestream =
-      caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data, len);
-  fn = *caml_named_value("drawJPEGMemory");
-  pdf_v = caml_callback2(fn, name_v, bytestream);
+  bytestream = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data,
+                                  (intnat)len);
+  NAMED_VALUE(fn, "drawJPEGMemory");
+  unit_v = caml_callback2(fn, name_v, bytestream);
   updateLastError();
-  CAMLreturnT(int, Int_val(pdf_v));
+  CPDFreturn0;
 }
 
-int cpdf_drawPNGMemory(char *name, void *data, int len) {
-  CAMLparam0();
-  CAMLlocal4(pdf_v, name_v, bytestream, fn);
+void cpdf_drawJPEGMemory(char *name, void *data, int len) {
+  cpdf_drawJPEGMemory64(name, data, len);
+}
+
+void cpdf_drawPNGMemory64(char *name, void *data, size_t len) {
+  CPDFparam0();
+  CAMLlocal4(unit_v, name_v, bytestream, fn);
   name_v = caml_copy_string(name);
-  bytestream =
-      caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data, len);
-  fn = *caml_named_value("drawPNGMemory");
-  pdf_v = caml_callback2(fn, name_v, bytestream);
+  bytestream = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, data,
+                                  (intnat)len);
+  NAMED_VALUE(fn, "drawPNGMemory");
+  unit_v = caml_callback2(fn, name_v, bytestream);
   updateLastError();
-  CAMLreturnT(int, Int_val(pdf_v));
+  CPDFreturn0;
+}
+
+void cpdf_drawPNGMemory(char *name, void *data, int len) {
+  cpdf_drawPNGMemory64(name, data, len);
 }
 
 /* __AUTO drawImage string->unit */
@@ -1843,27 +2960,22 @@ int cpdf_drawPNGMemory(char *name, void *data, int len) {
 /* __AUTO replaceDictEntry int->string->string->unit */
 /* __AUTO replaceDictEntrySearch int->string->string->string->unit */
 
-void *cpdf_getDictEntries(int pdf, char *key, int *retlen) {
-  CAMLparam0();
+void *cpdf_getDictEntries64(int pdf, char *key, size_t *retlen) {
+  CPDFparam0();
   CAMLlocal4(fn, bytestream, pdf_v, key_v);
-  fn = *caml_named_value("getDictEntries");
+  NAMED_VALUE(fn, "getDictEntries");
   pdf_v = Val_int(pdf);
   key_v = caml_copy_string(key);
   bytestream = caml_callback2(fn, pdf_v, key_v);
   updateLastError();
-  char *memory = NULL;
-  int size = Caml_ba_array_val(bytestream)->dim[0];
-  memory = calloc(size, sizeof(char));
-  if (memory == NULL && size > 0) fprintf(stderr, "getDictEntries: failed");
-  if (size > 0) {
-    int x;
-    char *indata = Caml_ba_data_val(bytestream);
-    for (x = 0; x < size; x++) {
-      memory[x] = indata[x];
-    };
-  }
-  *retlen = size;
-  CAMLreturnT(void *, memory);
+  void *memory = returnBytestream(bytestream, retlen, 1, "getDictEntries");
+  CPDFreturnT(void *, memory);
+}
+
+void *cpdf_getDictEntries(int pdf, char *key, int *retlen) {
+  size_t size;
+  void *memory = cpdf_getDictEntries64(pdf, key, &size);
+  return narrowLength(memory, size, retlen, "getDictEntries");
 }
 
 /* __AUTO removeClipping int->int->unit */
@@ -6,6 +6,8 @@
  * Text arguments and results are in UTF8.
  */
 
+#include <stddef.h>
+
 /* CHAPTER 0. Preliminaries */
 
 /* The function cpdf_startup(argv) must be called before using the library. */
@@ -48,6 +50,38 @@ char *cpdf_fLastErrorString(void);
 /* cpdf_clearError clears the current error state. */
 void cpdf_clearError(void);
 
+/*
+ * Calling cpdf_setThreadSafe with a true argument allows the library to be
+ * called from more than one thread. Calls are then run one at a time, and
+ * each thread has its own error state, which must be read with
+ * cpdf_fLastError and cpdf_fLastErrorString, and which reflects only that
+ * thread's most recent call. Sequences of calls which share state, such as
+ * cpdf_startGetBookmarkInfo to cpdf_endGetBookmarkInfo, must not be
+ * interleaved between threads unless each thread uses its own context (see
+ * below). A string returned to a thread, such as that of cpdf_version, is
+ * that thread's own copy, valid until its next call which returns a string.
+ * Set this from the thread which called cpdf_startup, before starting other
+ * threads. Once set, it cannot be unset.
+ * Default value: false.
+ */
+void cpdf_setThreadSafe(int);
+
+/*
+ * Sequences of calls such as cpdf_startGetBookmarkInfo to
+ * cpdf_endGetBookmarkInfo keep their state in the current context. To have
+ * more than one such sequence in progress at once, run each in its own
+ * context. cpdf_newContext() makes a new, empty context and returns its
+ * number. cpdf_setContext(context) makes it current, keeping the state of
+ * the previous one until it is made current again. Context 0 is current at
+ * startup. In thread-safe mode, each thread has its own current context.
+ * cpdf_deleteContext(context) deletes a context which is not current on any
+ * thread. A thread which finishes gives up its context, so that it can be
+ * deleted.
+ */
+int cpdf_newContext(void);
+void cpdf_setContext(int);
+void cpdf_deleteContext(int);
+
 /*
  * cpdf_onExit is a debug function which prints some information about
  * resource usage. This can be used to detect if PDFs or ranges are being
@@ -55,6 +89,59 @@ void cpdf_clearError(void);
  */
 void cpdf_onExit(void);
 
+/*
+ * cpdf_memoryUsage(pdf) returns an estimate of the memory in bytes used by a
+ * PDF: its objects, its stream data, and any buffer held for reading it
+ * lazily. A file loaded with cpdf_fromFileMapped is not counted, since it
+ * is held by the operating system. This takes time proportional to the size
+ * of the PDF.
+ */
+size_t cpdf_memoryUsage(int);
+
+/* Memory statistics for the whole library, as filled in by cpdf_memoryStats. */
+struct cpdf_memoryStats {
+  size_t heap_bytes;        /* Size of the OCaml heap */
+  size_t top_heap_bytes;    /* Largest size the OCaml heap has reached */
+  size_t minor_collections; /* Number of minor collections so far */
+  size_t major_collections; /* Number of major collections so far */
+  size_t compactions;       /* Number of heap compactions so far */
+  int pdfs;                 /* Number of PDFs allocated */
+  int ranges;               /* Number of ranges allocated */
+};
+
+/*
+ * cpdf_memoryStats(stats) fills in memory statistics for the library. This
+ * is cheap enough to call often.
+ */
+void cpdf_memoryStats(struct cpdf_memoryStats *);
+
+/*
+ * Functions which return a buffer, such as cpdf_toMemory, normally return a
+ * fresh copy of the data. Calling cpdf_setZeroCopy with a true argument makes
+ * those which build their output afresh, such as cpdf_toMemory and the JSON
+ * functions, return the library's own memory instead, avoiding the copy.
+ * Such a buffer must not be written to, and must be given back with
+ * cpdf_releaseBuffer, not free, when no longer needed. Data which belongs to
+ * a PDF, such as from cpdf_getAttachmentData or cpdf_getMetadata, is always
+ * copied. Default value: false.
+ */
+void cpdf_setZeroCopy(int);
+
+/*
+ * cpdf_releaseBuffer(data) releases a buffer returned by the library,
+ * whether it was copied or not.
+ */
+void cpdf_releaseBuffer(void *);
+
+/*
+ * Each function which takes or returns a buffer in memory has a counterpart
+ * with the suffix 64, which takes or returns the length as a size_t instead
+ * of an int. Use these for buffers of 2GB or more. For example,
+ * cpdf_fromMemory64(data, length, userpw) and cpdf_toMemory64(pdf,
+ * linearize, make_id, &length). If a result is too large for an int, the
+ * int variant sets an error and returns NULL with a length of zero.
+ */
+
 /* CHAPTER 1. Basics */
 
 /*
@@ -78,6 +165,7 @@ int cpdf_fromFileLazy(const char[], const char[]);
  * pointer and a length, and the user password.
  */
 int cpdf_fromMemory(void *, int, const char[]);
+int cpdf_fromMemory64(void *, size_t, const char[]);
 
 /*
  * cpdf_fromMemory(data, length, userpw) loads a file from memory, given a
@@ -85,10 +173,65 @@ int cpdf_fromMemory(void *, int, const char[]);
  * cpdf_fromFileLazy.
  */
 int cpdf_fromMemoryLazy(void *, int, const char[]);
+int cpdf_fromMemoryLazy64(void *, size_t, const char[]);
+
+/*
+ * A source reads data for cpdf_fromSource. It is called as
+ * read(user_data, offset, buffer, length) and must copy up to length bytes
+ * starting at offset into buffer, returning the number of bytes copied, or a
+ * negative number on error. Reads need not be in order.
+ */
+typedef int (*cpdf_source)(void *, size_t, void *, int);
+
+/*
+ * cpdf_fromSource(source, length, user_data, lazy, userpw) loads a file of
+ * the given length from a source, given the user password. If lazy is true,
+ * parts of the file are read only when needed, and the source must remain
+ * valid until the PDF is deleted. Otherwise, the whole file is read before
+ * this function returns. Either way, no copy of the whole file is made in
+ * memory.
+ */
+int cpdf_fromSource(cpdf_source, size_t, void *, int, const char[]);
+
+/*
+ * cpdf_fromFileMapped(filename, userpw) loads a file lazily, like
+ * cpdf_fromFileLazy, but by mapping it into memory rather than reading it.
+ * Objects are then parsed from the mapping without further system calls,
+ * and the file's pages are shared with other processes mapping it. The file
+ * stays mapped until neither the PDF nor any made from it, for example by
+ * cpdf_selectPages, can still read from it, and must not be changed until
+ * then. Not available on Windows.
+ */
+int cpdf_fromFileMapped(const char[], const char[]);
 
 /* Remove a PDF from memory, given its number. */
 void cpdf_deletePdf(int);
 
+/*
+ * cpdf_setGCParams(minor_heap_words, space_overhead, max_overhead) sets
+ * parameters of the OCaml garbage collector: the size of the minor heap in
+ * words, the percentage of wasted memory the major collector tolerates, and
+ * the percentage above which it compacts the heap. A zero leaves a parameter
+ * unchanged. See the OCaml Gc module for details.
+ */
+void cpdf_setGCParams(int, int, int);
+
+/*
+ * cpdf_compactHeap() runs a full collection and compacts the heap, giving
+ * freed memory back to the operating system. cpdf_fullMajor() runs a full
+ * collection without compacting.
+ */
+void cpdf_compactHeap(void);
+void cpdf_fullMajor(void);
+
+/*
+ * cpdf_setCompactThreshold(bytes) makes cpdf_deletePdf compact the heap
+ * when it has grown by at least this many bytes since the last compaction.
+ * The PDF deleted is not measured, so this costs little on each call. Zero,
+ * the default, turns this off.
+ */
+void cpdf_setCompactThreshold(size_t);
+
 /*
  * Calling cpdf_replacePdf(a, b) places PDF b under number a. Number b is no
  * longer available.
@@ -106,6 +249,21 @@ int cpdf_enumeratePDFsKey(int);
 char *cpdf_enumeratePDFsInfo(int);
 void cpdf_endEnumeratePDFs(void);
 
+/*
+ * cpdf_beginScope() starts a scope. Every PDF and range made until the
+ * matching cpdf_endScope() is deleted by that call, unless already deleted.
+ * Scopes may be nested, in which case cpdf_endScope() ends the innermost.
+ * Make any PDF or range which must outlive the scope before beginning it.
+ * Each context has its own scopes.
+ */
+void cpdf_beginScope(void);
+void cpdf_endScope(void);
+
+/* cpdf_numPdfs() and cpdf_numRanges() return the number of PDFs and ranges
+ * currently allocated. */
+int cpdf_numPdfs(void);
+int cpdf_numRanges(void);
+
 /* Convert a figure in centimetres to points (72 points to 1 inch) */
 double cpdf_ptOfCm(double);
 
@@ -227,6 +385,19 @@ int cpdf_rangeGet(int, int);
  */
 int cpdf_rangeAdd(int, int);
 
+/*
+ * cpdf_rangeFromArray(pages, n) builds a range from an array of n page
+ * numbers, in one step. Use this instead of many calls to cpdf_rangeAdd.
+ */
+int cpdf_rangeFromArray(int *, int);
+
+/*
+ * cpdf_rangeToArray(range, out) copies the page numbers in a range to an
+ * array, which must have room for cpdf_rangeLength(range) entries. Returns
+ * the number of entries copied.
+ */
+int cpdf_rangeToArray(int, int *);
+
 /*
  * cpdf_isInRange(range, page) returns true if the page is in the range,
  * false otherwise.
@@ -243,10 +414,38 @@ int cpdf_pages(int);
  */
 int cpdf_pagesFast(const char[], const char[]);
 
+/*
+ * cpdf_setPagesFastCache(size) keeps the page counts found by
+ * cpdf_pagesFast for up to size files, so that asking again for the same
+ * file, with the same password, does not read it. A file is known by its
+ * name, length and modification time, so a changed file is read afresh. On
+ * Windows, modification times are to the second only. When the cache is
+ * full, the file least recently asked for is forgotten. A size of zero, the
+ * default, turns the cache off. Setting the size empties the cache and
+ * resets its counters. cpdf_pagesFastCacheHits() and
+ * cpdf_pagesFastCacheMisses() return the number of times a page count was
+ * and was not found in the cache.
+ */
+void cpdf_setPagesFastCache(int);
+int cpdf_pagesFastCacheHits(void);
+int cpdf_pagesFastCacheMisses(void);
+
+/*
+ * cpdf_setRemoveUnreferenced(remove) sets whether objects no longer
+ * referenced are removed before writing, which walks the whole PDF. The
+ * default is true. Once done, the walk is not repeated for a PDF until it
+ * is changed. Turning it off makes writing an unchanged or barely changed
+ * large file cheaper, at the cost of keeping any unreferenced objects.
+ */
+void cpdf_setRemoveUnreferenced(int);
+
 /*
  * cpdf_toFile (pdf, filename, linearize, make_id) writes the file to a given
- * filename. If linearize is true, it will be linearized if a linearizer is
- * available. If make_id is true, it will be given a new ID.
+ * filename. If linearize is true, it will be linearized, so that a viewer
+ * may show the first page before the rest of the file has arrived. A PDF
+ * which is still encrypted is written without linearization. If make_id is
+ * true, it will be given a new ID. Otherwise, the existing ID, if any, is
+ * kept.
  *
  * NB: Unlike with the command line tool, cpdf, streams decompressed during
  * processing will not automatically be compressed when writing. Call
@@ -254,10 +453,26 @@ int cpdf_pagesFast(const char[], const char[]);
  */
 void cpdf_toFile(int, const char[], int, int);
 
+/*
+ * cpdf_toFileIncremental(pdf, filename) writes the file as an incremental
+ * update to the file it was read from: the original bytes, followed by the
+ * objects which have changed or been added, and a new cross-reference
+ * section and trailer. Objects deleted are marked free. The new section is a
+ * cross-reference stream if the original's last section was. The file is
+ * written to a temporary file which is then renamed, so filename may be the
+ * original file. Only objects parsed since reading are compared with the
+ * original, so with cpdf_fromFileLazy the time taken is in proportion to the
+ * edit. Signatures over the original bytes remain
+ * valid. The PDF must have been read with cpdf_fromFile, cpdf_fromFileLazy
+ * or cpdf_fromFileMapped, and must not be encrypted.
+ */
+void cpdf_toFileIncremental(int, const char[]);
+
 /*
  * cpdf_toFileExt (pdf, filename, linearize, make_id, preserve_objstm,
  * generate_objstm, compress_objstm) writes the file to a given filename. If
- * make_id is true, it will be given a new ID.  If preserve_objstm is true,
+ * linearize is true, it will be linearized, and object streams are not used.
+ * If make_id is true, it will be given a new ID.  If preserve_objstm is true,
  * existing object streams will be preserved. If generate_objstm is true,
  * object streams will be generated even if not originally present. If
  * compress_objstm is true, object streams will be compressed (what we
@@ -275,6 +490,29 @@ void cpdf_toFileExt(int, const char[], int, int, int, int, int);
  * cpdf_compress() first.
  */
 void *cpdf_toMemory(int, int, int, int *);
+void *cpdf_toMemory64(int, int, int, size_t *);
+
+/*
+ * A sink is a function which is given the output of a write a chunk at a
+ * time, as sink(user_data, data, length). It should return zero on success,
+ * or non-zero to abandon the write, which is then reported as an error.
+ */
+typedef int (*cpdf_sink)(void *, const void *, size_t);
+
+/*
+ * cpdf_toSink(pdf, sink, user_data, linearize, make_id) writes the file
+ * to a sink, without building the whole file in memory first. The arguments
+ * are otherwise as for cpdf_toFile.
+ */
+void cpdf_toSink(int, cpdf_sink, void *, int, int);
+
+/*
+ * cpdf_toSinkExt(pdf, sink, user_data, linearize, make_id, preserve_objstm,
+ * generate_objstm, compress_objstm) writes the file to a sink. The arguments
+ * are otherwise as for cpdf_toFileExt. WARNING: the pdf argument will be
+ * invalid after this call, and should be discarded.
+ */
+void cpdf_toSinkExt(int, cpdf_sink, void *, int, int, int, int, int);
 
 /*
  * cpdf_isEncrypted(pdf) returns true if a documented is encrypted, false
@@ -329,7 +567,7 @@ enum cpdf_encryptionMethod {
 /*
  * cpdf_toFileEncrypted(pdf, encryption_method, permissions,
  * permission_length, owner_password, user password, linearize, makeid,
- * filename) writes a file as encrypted.
+ * filename) writes a file as encrypted. Encrypted files are not linearized.
  */
 void cpdf_toFileEncrypted(int, int, int *, int, const char[], const char[], int,
                           int, const char[]);
@@ -391,6 +629,65 @@ int cpdf_mergeSame(int *, int, int, int, int *);
  */
 int cpdf_selectPages(int, int);
 
+/*
+ * Streaming merge. cpdf_mergeBegin(sink, user_data) starts a merge which
+ * writes to the given sink, returning a number for it. Each call to
+ * cpdf_mergeAppendFile(merge, filename, userpw) or
+ * cpdf_mergeAppendMemory(merge, data, length, userpw) reads one PDF and
+ * writes its pages, and the objects they use, to the sink at once, so the
+ * inputs are never all in memory together. cpdf_mergeEndToSink(merge) writes
+ * the page tree, cross-reference table and trailer, and finishes the merge.
+ * Only pages are merged: bookmarks, forms and other document-level
+ * structures of the inputs are not kept.
+ */
+int cpdf_mergeBegin(cpdf_sink, void *);
+
+/*
+ * cpdf_mergeDeduplicate(merge, deduplicate) sets whether a streaming merge
+ * deduplicates resources. If true, an image, font, form XObject, colour
+ * profile or other resource identical, with everything it refers to, to one
+ * already written is not written again, and pages using it refer to the
+ * first copy instead. Resources are compared by a SHA-256 hash of their
+ * contents, so only a hash is kept for each resource written, and one input
+ * cannot be crafted to replace the resources of another. Default false.
+ */
+void cpdf_mergeDeduplicate(int, int);
+void cpdf_mergeAppendFile(int, const char[], const char[]);
+void cpdf_mergeAppendMemory(int, void *, int, const char[]);
+void cpdf_mergeAppendMemory64(int, void *, size_t, const char[]);
+void cpdf_mergeEndToSink(int);
+
+/*
+ * cpdf_splitToFiles(pdf, ranges, len, filename) writes one file for each of
+ * the len ranges, containing those pages of the document. In the filename,
+ * @N is replaced by the number of the output, counting from one, and @S and
+ * @E by its first and last page numbers. A filename which would be the same
+ * for two parts is an error, so use @N when there is more than one. Each
+ * part is as cpdf_selectPages followed by cpdf_toFile would give, keeping
+ * the document information, bookmarks, forms and other document-level
+ * structures. The document must not be encrypted.
+ */
+void cpdf_splitToFiles(int, int *, int, const char *);
+
+/*
+ * cpdf_splitToFilesBySize(pdf, maxbytes, filename) splits a document into
+ * parts of at most about maxbytes bytes each, named as for
+ * cpdf_splitToFiles. The size of each page, including the fonts, images and
+ * other resources it uses, is estimated from the document in a single pass,
+ * counting a resource shared by pages once per part, without trial writes.
+ * A page too large on its own is written to a part by itself.
+ */
+void cpdf_splitToFilesBySize(int, int, const char[]);
+
+/*
+ * cpdf_splitToFilesOnBookmarks(pdf, level, maxbytes, filename) splits a
+ * document before each page with a bookmark at the given level, where 0 is
+ * the top level, naming the parts as for cpdf_splitToFiles. If maxbytes is
+ * not zero, parts larger than that are split further, as
+ * cpdf_splitToFilesBySize.
+ */
+void cpdf_splitToFilesOnBookmarks(int, int, int, const char[]);
+
 /* CHAPTER 3. Pages */
 
 /*
@@ -576,6 +873,13 @@ void cpdf_hardBox(int, int, const char[]);
 
 /* CHAPTER 5. Compression */
 
+/*
+ * cpdf_setCompressionThreads(n) sets the number of threads cpdf_compress
+ * uses to deflate streams. Each stream is deflated on its own, so the
+ * output does not depend on the number of threads. The default is one.
+ */
+void cpdf_setCompressionThreads(int);
+
 /*
  * cpdf_compress(pdf) compresses any uncompressed streams in the given PDF
  * using the Flate algorithm.
@@ -664,10 +968,12 @@ void cpdf_endSetBookmarkInfo(int);
 /* cpdf_getBookmarksJSON(pdf, length) returns the bookmark data and sets the
  * length. */
 void *cpdf_getBookmarksJSON(int, int *);
+void *cpdf_getBookmarksJSON64(int, size_t *);
 
 /* cpdf_setBookmarksJSON(pdf, data, datalength) sets the bookmarks from JSON
  * bookmark data. */
 void cpdf_setBookmarksJSON(int, void *, int);
+void cpdf_setBookmarksJSON64(int, void *, size_t);
 
 /* cpdf_tableOfContents(pdf, font, fontsize, title, bookmark) typesets a table
  * of contents from existing bookmarks and prepends it to the document. If
@@ -918,6 +1224,7 @@ void cpdf_twoUpStack(int);
 /* Return the annotations from a PDF in JSON format, returning also its length.
  */
 void *cpdf_annotationsJSON(int, int *);
+void *cpdf_annotationsJSON64(int, size_t *);
 
 /* cpdf_removeAnnotations(pdf, range) removes all annotations from pages in the
  * given range. */
@@ -926,6 +1233,7 @@ void cpdf_removeAnnotations(int, int);
 /* cpdf_setAnnotationsJSON(pdf, data, length) adds the annotations given in
  * JSON format to the PDF, on top of any existing annotations. */
 void cpdf_setAnnotationsJSON(int, void *, int);
+void cpdf_setAnnotationsJSON64(int, void *, size_t);
 
 /* CHAPTER 11. Document Information and Metadata */
 
@@ -1115,6 +1423,39 @@ void cpdf_getTrimBox(int, int, double *, double *, double *, double *);
 void cpdf_getArtBox(int, int, double *, double *, double *, double *);
 void cpdf_getBleedBox(int, int, double *, double *, double *, double *);
 
+/* A box, as returned by cpdf_getPageGeometryBatch. */
+struct cpdf_box {
+  double minx;
+  double maxx;
+  double miny;
+  double maxy;
+};
+
+/*
+ * The geometry of a page. Boxes not present on the page are given as the
+ * crop box, or the media box if there is no crop box.
+ */
+struct cpdf_pageGeometry {
+  int pagenumber;             /* Page number */
+  struct cpdf_box mediabox;   /* Media box */
+  struct cpdf_box cropbox;    /* Crop box */
+  struct cpdf_box trimbox;    /* Trim box */
+  struct cpdf_box artbox;     /* Art box */
+  struct cpdf_box bleedbox;   /* Bleed box */
+  int rotation;               /* Viewing rotation */
+  int annotations;            /* Number of annotations */
+  int fonts;                  /* Number of fonts in the page's resources */
+  int xobjects;               /* Number of XObjects in the page's resources */
+};
+
+/*
+ * cpdf_getPageGeometryBatch(pdf, range, out) fills in the geometry of each
+ * page in the range, in order, reading the page tree only once. The array
+ * out must have room for cpdf_rangeLength(range) entries. Returns the number
+ * of entries filled in.
+ */
+int cpdf_getPageGeometryBatch(int, int, struct cpdf_pageGeometry *);
+
 /*
  * These functions set a box given the document, page range, min x, max x,
  * min y, max y in points.
@@ -1128,6 +1469,7 @@ void cpdf_setBleedBox(int, int, double, double, double, double);
 /* cpdf_pageInfoJSON(pdf, size) returns JSON data for the page
 information, and fills in the return length. */
 void *cpdf_pageInfoJSON(int, int *);
+void *cpdf_pageInfoJSON64(int, size_t *);
 
 /* cpdf_markTrapped(pdf) marks a document as trapped. */
 void cpdf_markTrapped(int);
@@ -1233,12 +1575,14 @@ void cpdf_setMetadataFromFile(int, const char[]);
  * an array of bytes.
  */
 void cpdf_setMetadataFromByteArray(int, void *, int);
+void cpdf_setMetadataFromByteArray64(int, void *, size_t);
 
 /*
  * cpdf_getMetadata(pdf, length) returns the XMP metadata and fills in
  * length.
  */
 void *cpdf_getMetadata(int, int *);
+void *cpdf_getMetadata64(int, size_t *);
 
 /* cpdf_removeMetadata(pdf) removes the XMP metadata from a document. */
 void cpdf_removeMetadata(int);
@@ -1314,6 +1658,7 @@ void cpdf_endGetPageLabels();
 /* cpdf_compositionJSON(filesize, pdf, size) returns the composition data in
  * JSON format, filling in the return length. */
 void *cpdf_compositionJSON(int, int, int *);
+void *cpdf_compositionJSON64(size_t, int, size_t *);
 
 /* CHAPTER 12. File Attachments */
 
@@ -1334,12 +1679,15 @@ void cpdf_attachFileToPage(const char[], int, int);
  * memory, just like cpdf_attachFile.
  */
 void cpdf_attachFileFromMemory(void *, int, const char[], int);
+void cpdf_attachFileFromMemory64(void *, size_t, const char[], int);
 
 /*
  * cpdf_attachFileToPageFromMemory(memory, length, filename, pdf, pagenumber)
  * attaches from memory, just like cpdf_attachFileToPage.
  */
 void cpdf_attachFileToPageFromMemory(void *, int, const char[], int, int);
+void cpdf_attachFileToPageFromMemory64(void *, size_t, const char[], int,
+                                       int);
 
 /* Remove all page- and document-level attachments from a document. */
 void cpdf_removeAttachedFiles(int);
@@ -1366,6 +1714,7 @@ int cpdf_getAttachmentPage(int);
  * data, and its length.
  */
 void *cpdf_getAttachmentData(int, int *);
+void *cpdf_getAttachmentData64(int, size_t *);
 
 /* Clean up after getting attachments. */
 void cpdf_endGetAttachments(void);
@@ -1408,9 +1757,11 @@ void cpdf_endGetImageResolution(void);
 
 /* Get image resolution data in JSON format */
 void *cpdf_imageResolutionJSON(int, int *, float);
+void *cpdf_imageResolutionJSON64(int, size_t *, double);
 
 /* Get image data in JSON format */
 void *cpdf_imagesJSON(int, int *);
+void *cpdf_imagesJSON64(int, size_t *);
 
 /* CHAPTER 14. Fonts. */
 
@@ -1432,6 +1783,7 @@ void cpdf_endGetFontInfo(void);
 /* cpdf_fontsJSON(pdf, size) returns JSON data for the font list, and fills
  * in the return length. */
 void *cpdf_fontsJSON(int, int *);
+void *cpdf_fontsJSON64(int, size_t *);
 
 /* cpdf_removeFonts(pdf) removes all font data from a file. */
 void cpdf_removeFonts(int);
@@ -1458,12 +1810,14 @@ void cpdf_outputJSON(const char[], int, int, int, int);
 /* cpdf_outputJSONMemory(parse_content, no_stream_data, pdf, size) is like
  * outputJSON, but it writes to a buffer in memory. The length is filled in. */
 void *cpdf_outputJSONMemory(int, int, int, int, int *);
+void *cpdf_outputJSONMemory64(int, int, int, int, size_t *);
 
 /* Load a PDF from a JSON file given its filename. */
 int cpdf_fromJSON(const char[]);
 
 /* Load a PDF from a JSON file in memory, given the buffer and its length. */
 int cpdf_fromJSONMemory(void *, int);
+int cpdf_fromJSONMemory64(void *, size_t);
 
 /* CHAPTER 16. Optional Content Groups */
 
@@ -1512,6 +1866,8 @@ int cpdf_textToPDF(double, double, const char[], double, const char[]);
  * file ragged right on a page of size w * h in points in the given font and
  * font size. */
 int cpdf_textToPDFMemory(double, double, const char[], double, void *, int);
+int cpdf_textToPDFMemory64(double, double, const char[], double, void *,
+                           size_t);
 
 /* cpdf_textToPDF(papersize, font, fontsize, filename) typesets a UTF8 text file
  * ragged right on a page of the given size in the given font and font size. */
@@ -1521,6 +1877,7 @@ int cpdf_textToPDFPaper(int, const char[], double, const char[]);
  * text file ragged right on a page of the given size in the given font and
  * font size. */
 int cpdf_textToPDFPaperMemory(int, const char[], double, void *, int);
+int cpdf_textToPDFPaperMemory64(int, const char[], double, void *, size_t);
 
 /* cpdf_fromPNG(filename) builds a PDF from a non-interlaced non-transparent
  * PNG. */
@@ -1529,12 +1886,14 @@ int cpdf_fromPNG(const char[]);
 /* cpdf_fromPNGMemory(data, length) builds a PDF from a non-interlaced
  * non-transparent PNG. */
 int cpdf_fromPNGMemory(void *, int);
+int cpdf_fromPNGMemory64(void *, size_t);
 
 /* cpdf_fromJPEG(filename) builds a PDF from a JPEG. */
 int cpdf_fromJPEG(const char[]);
 
 /* cpdf_fromJPEGMemory(data, length) builds a PDF from a JPEG. */
 int cpdf_fromJPEGMemory(void *, int);
+int cpdf_fromJPEGMemory64(void *, size_t);
 
 /* CHAPTER 18. Drawing on PDFs */
 
@@ -1701,6 +2060,7 @@ void cpdf_drawJPEG(char *, char *);
 /* cpdf_drawJPEGMemory(name, data, length) loads a JPEG from the given file,
  * storing it under the given name. */
 void cpdf_drawJPEGMemory(char *, void *, int);
+void cpdf_drawJPEGMemory64(char *, void *, size_t);
 
 /* cpdf_drawPNG(name, filename) loads a non-interlaced non-transparent
  * PNG from the given file, storing it under the given name. */
@@ -1709,6 +2069,7 @@ void cpdf_drawPNG(char *, char *);
 /* cpdf_drawPNG(name, data, length) loads a non-interlaced non-transparent
  * PNG from the given file, storing it under the given name. */
 void cpdf_drawPNGMemory(char *, void *, int);
+void cpdf_drawPNGMemory64(char *, void *, size_t);
 
 /* cpdf_drawImage(name) draws a stored image. To draw at the expected size, it
  * is required to scale the Current Transformation Matrix by the width and
@@ -1830,6 +2191,7 @@ void cpdf_replaceDictEntrySearch(int, const char[], const char[], const char[]);
 /* cpdf_getDictEntries(pdf, key, length) returns a JSON array containing any
  * and all values associated with the given key, and fills in its length. */
 void *cpdf_getDictEntries(int, const char[], int *);
+void *cpdf_getDictEntries64(int, const char[], size_t *);
 
 /*
  * cpdf_removeClipping(pdf, range) removes all clipping from pages in the
@@ -0,0 +1,58 @@
+/*
+ * Compare writing the manual with and without linearization. For each, print
+ * the time taken, the length of the file, and how many bytes must arrive
+ * before the first page can be shown: the /E entry of a linearized file, or
+ * the whole file otherwise.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../cpdflibwrapper.h"
+
+/* Find the end of the first page section, or the length of the file. */
+static long first_page_bytes(const char *filename, long *length)
+{
+  char head[1025];
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) return -1;
+  size_t n = fread(head, 1, 1024, f);
+  head[n] = '\0';
+  fseek(f, 0, SEEK_END);
+  *length = ftell(f);
+  fclose(f);
+  char *e = strstr(head, "/Linearized") ? strstr(head, "/E ") : NULL;
+  return e ? atol(e + 3) : *length;
+}
+
+static int write_manual(bool linearize, const char *filename)
+{
+  int pdf = cpdf_fromFile("../cpdflibmanual.pdf", "");
+  if (cpdf_lastError) return 1;
+  clock_t start = clock();
+  cpdf_toFile(pdf, filename, linearize, false);
+  clock_t end = clock();
+  if (cpdf_lastError) return 1;
+  cpdf_deletePdf(pdf);
+  long length;
+  long first = first_page_bytes(filename, &length);
+  printf("%s: %.3fs, %li bytes, first page after %li bytes\n",
+         linearize ? "linearized" : "plain", (double)(end - start) / CLOCKS_PER_SEC,
+         length, first);
+  return 0;
+}
+
+int main (int argc, char ** argv)
+{
+  /* Initialise cpdf */
+  cpdf_startup(argv);
+
+  /* Clear the error state */
+  cpdf_clearError();
+
+  if (write_manual(false, "plain.pdf")) return 1;
+  if (write_manual(true, "linearized.pdf")) return 1;
+
+  return 0;
+}